@@ -0,0 +1,109 @@
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARMV8
+#include <arm_acle.h>
+#endif
+
+#if defined(__GNUC__)
+#define CRC32C_CONSTRUCTOR __attribute__((constructor))
+#else
+#define CRC32C_CONSTRUCTOR
+#endif
+
+#define CRC32C_POLY 0x82f63b78u // Reflected
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *po, size_t co);
+
+static uint32_t table[8][256];
+static crc32c_fn impl;
+
+static uint32_t load_le32(const uint8_t *po) {
+    return (uint32_t)po[0] | (uint32_t)po[1] << 8 | (uint32_t)po[2] << 16 | (uint32_t)po[3] << 24;
+}
+
+/*
+ * Slicing-by-8: eight table lookups per eight octets.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *po, size_t co) {
+    while (co >= 8) {
+        uint32_t lo = crc ^ load_le32(po);
+        uint32_t hi = load_le32(po + 4);
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+              table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+              table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        po += 8;
+        co -= 8;
+    }
+    while (co-- > 0)
+        crc = table[0][(crc ^ *po++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *po, size_t co) {
+    uint64_t crc64 = crc;
+    while (co >= 8) {
+        uint64_t val;
+        memcpy(&val, po, 8);
+        crc64 = _mm_crc32_u64(crc64, val);
+        po += 8;
+        co -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (co-- > 0)
+        crc = _mm_crc32_u8(crc, *po++);
+    return crc;
+}
+#elif defined(CRC32C_ARMV8)
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *po, size_t co) {
+    while (co >= 8) {
+        uint64_t val;
+        memcpy(&val, po, 8);
+        crc = __crc32cd(crc, val);
+        po += 8;
+        co -= 8;
+    }
+    while (co-- > 0)
+        crc = __crc32cb(crc, *po++);
+    return crc;
+}
+#endif
+
+/*
+ * Runs before main() where supported, so that the tables are never built
+ * concurrently. Otherwise on first use.
+ */
+CRC32C_CONSTRUCTOR static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; ++k)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][i] = crc;
+    }
+    for (int t = 1; t < 8; ++t) {
+        for (int i = 0; i < 256; ++i)
+            table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+    }
+#if defined(CRC32C_SSE42)
+    __builtin_cpu_init();
+    impl = __builtin_cpu_supports("sse4.2") ? crc32c_hw : crc32c_sw;
+#elif defined(CRC32C_ARMV8)
+    impl = crc32c_hw;
+#else
+    impl = crc32c_sw;
+#endif
+}
+
+uint32_t tasn1_crc32c_update(uint32_t crc, const uint8_t *po, size_t co) {
+    if (!impl)
+        crc32c_init();
+    return impl(crc, po, co);
+}
@@ -0,0 +1,15 @@
+#ifndef TASN1_CRC32C_H
+#define TASN1_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli), private to the tasn1 library. crc is the running
+ * register: start with CRC32C_INIT and invert the final value.
+ */
+#define CRC32C_INIT 0xffffffffu
+
+uint32_t tasn1_crc32c_update(uint32_t crc, const uint8_t *po, size_t co);
+
+#endif // TASN1_CRC32C_H
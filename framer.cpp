@@ -0,0 +1,67 @@
+#include "tasn1/framer.hpp"
+#include "tasn1/tasn1.h"
+
+#include <algorithm>
+#include <string>
+
+namespace tasn1 {
+
+size_t Framer::peek(const uint8_t *po, size_t co) const {
+    int n{::tasn1_peek_size(po, co)};
+    if (n < 0)
+        throw std::runtime_error("Invalid header " + std::to_string(n));
+    if (n > 0 && checksummed)
+        n += TASN1_CRC_SIZE;
+    return static_cast<size_t>(n);
+}
+
+bool Framer::verify(const uint8_t *po, size_t co, batch_t &batch) {
+    if (!checksummed) {
+        batch.push_back(Frame{po, co});
+        return true;
+    }
+    const uint8_t *val{nullptr};
+    int n{::tasn1_verify_framed(po, co, &val)};
+    if (n < 0) {
+        ++dropped;
+        return false;
+    }
+    batch.push_back(Frame{val, static_cast<size_t>(n)});
+    return true;
+}
+
+size_t Framer::feed(const uint8_t *po, size_t co, batch_t &batch) {
+    size_t count{0};
+    completed.clear();
+
+    // Finish the message started by an earlier feed:
+    while (!partial.empty() && co > 0) {
+        size_t n{peek(partial.data(), partial.size())};
+        size_t take{(n == 0) ? 1 : std::min(n - partial.size(), co)};
+        partial.insert(partial.end(), po, po + take);
+        po += take;
+        co -= take;
+        if (n != 0 && partial.size() == n) {
+            completed.swap(partial);
+            partial.clear();
+            if (verify(completed.data(), completed.size(), batch))
+                ++count;
+        }
+    }
+    if (!partial.empty())
+        return count;
+
+    while (co > 0) {
+        size_t n{peek(po, co)};
+        if (n == 0 || n > co)
+            break;
+        if (verify(po, n, batch))
+            ++count;
+        po += n;
+        co -= n;
+    }
+    partial.assign(po, po + co);
+    return count;
+}
+
+} // end namespace tasn1 //
@@ -0,0 +1,25 @@
+#include "tasn1/frozen.hpp"
+#include "tasn1/tasn1.h"
+
+namespace tasn1 {
+
+struct tasn1_node *Frozen::freeze(Node &node) {
+    if (node.isContained())
+        throw std::runtime_error("Node is already contained");
+    struct tasn1_node *res{::tasn1_freeze(node.getNode())};
+    if (!res)
+        throw std::runtime_error("Unable to freeze node");
+    node.release(); // Released by tasn1_freeze()
+    return res;
+}
+
+Frozen::Frozen(Node &node): Node(freeze(node)) {}
+
+Frozen Frozen::share() const {
+    struct tasn1_node *res{::tasn1_share(node)};
+    if (!res)
+        throw std::runtime_error("Unable to share node");
+    return Frozen(res);
+}
+
+} // end namespace tasn1 //
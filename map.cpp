@@ -4,16 +4,18 @@
 
 namespace tasn1 {
 
-Map::Map(): Node(tasn1_new_map()) {}
+Map::Map(bool indexed): Node(indexed ? tasn1_new_indexed_map() : tasn1_new_map()) {}
 
 void Map::add(Node &key, Node &val) {
     if (key.isContained())
         throw std::runtime_error("Key is already contained");
     if (val.isContained())
         throw std::runtime_error("Val is already contained");
+    int erc{::tasn1_add_map_item(node, key.getNode(), val.getNode())};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
     key.setContained();
     val.setContained();
-    ::tasn1_add_map_item(node, key.getNode(), val.getNode());
 }
 
 void Map::add(const std::string &key, Node &val) {
@@ -5,13 +5,60 @@
 #include "tasn1/octetsequence.hpp"
 #include "tasn1/tasn1.h"
 
+#include <exception>
 #include <functional>
+#include <thread>
 
 using namespace std;
 using namespace jsonx;
 
 namespace tasn1 {
 
+// Containers with fewer children are not split across threads:
+static const size_t PARALLEL_MIN_CHILDREN{64};
+
+/*
+ * Convert the children in contiguous chunks, one per thread and at most
+ * one thread per child. The calling thread converts the last chunk.
+ * Returns the chunks in order.
+ */
+template <typename T, typename F>
+static vector<vector<Node>> convertChunks(const vector<const T *> &children, unsigned threads, F convert) {
+    size_t n{children.size()};
+    threads = static_cast<unsigned>(max<size_t>(1, min<size_t>(threads, n)));
+    vector<vector<Node>> chunks(threads);
+    vector<exception_ptr> errors(threads);
+    auto work = [&] (unsigned t) {
+        try {
+            size_t first{n * t / threads};
+            size_t last{n * (t + 1) / threads};
+            chunks[t].reserve(last - first);
+            for (size_t i = first; i < last; ++i)
+                chunks[t].push_back(convert(*children[i]));
+        } catch (...) {
+            errors[t] = current_exception();
+        }
+    };
+    vector<thread> workers;
+    workers.reserve(threads - 1);
+    try {
+        for (unsigned t = 0; t + 1 < threads; ++t)
+            workers.emplace_back(work, t);
+    } catch (...) {
+        for (thread &w : workers)
+            w.join();
+        throw;
+    }
+    work(threads - 1);
+    for (thread &w : workers)
+        w.join();
+    for (exception_ptr &e : errors) {
+        if (e)
+            rethrow_exception(e);
+    }
+    return chunks;
+}
+
 Node Node::fromJson(const jsonx::json &j) {
     switch (j.getType()) {
     case json::UNDEFINED_T :
@@ -59,6 +106,69 @@ Node Node::fromJson(const jsonx::json &j) {
     } // end switch //
 }
 
+Node Node::fromJson(const jsonx::json &j, unsigned threads) {
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    if (threads == 1)
+        return fromJson(j);
+    switch (j.getType()) {
+    case json::ARRAY_T :
+    {
+        tasn1::Array ta;
+        const json_array_t &ja{j.toArrayRef()};
+        if (ja.size() < PARALLEL_MIN_CHILDREN) {
+            // Look for large containers further down:
+            for (const json &j1 : ja) {
+                tasn1::Node n{fromJson(j1, threads)};
+                ta.add(n);
+            } // end for //
+            return move(ta);
+        }
+        vector<const json *> children;
+        children.reserve(ja.size());
+        for (const json &j1 : ja)
+            children.push_back(&j1);
+        vector<vector<Node>> chunks{convertChunks(children, threads, [] (const json &j1) {
+            return fromJson(j1);
+        })};
+        for (vector<Node> &chunk : chunks) {
+            for (Node &n : chunk)
+                ta.add(n);
+        } // end for //
+        return move(ta);
+    }
+    case json::OBJECT_T : {
+        tasn1::Map tm;
+        const json_object_t &jo{j.toObject()};
+        if (jo.size() < PARALLEL_MIN_CHILDREN) {
+            for (const json_object_value_t &pair : jo) {
+                tasn1::OctetSequence key(pair.first);
+                tasn1::Node val(fromJson(pair.second, threads));
+                tm.add(key, val);
+            } // end for //
+            return move(tm);
+        }
+        vector<const json_object_value_t *> children;
+        children.reserve(jo.size());
+        for (const json_object_value_t &pair : jo)
+            children.push_back(&pair);
+        vector<vector<Node>> chunks{convertChunks(children, threads, [] (const json_object_value_t &pair) {
+            return fromJson(pair.second);
+        })};
+        size_t i{0};
+        for (vector<Node> &chunk : chunks) {
+            for (Node &val : chunk) {
+                tasn1::OctetSequence key(children[i++]->first);
+                tm.add(key, val);
+            } // end for //
+        } // end for //
+        return move(tm);
+    }
+    default:
+        return fromJson(j);
+    } // end switch //
+}
+
 Node::Node(Node &&other) {
     node = other.node;
     other.node = nullptr;
@@ -74,16 +184,92 @@ Node::~Node() {
     contained = false;
 }
 
-void Node::serialize(vector_t &buffer) {
+Node Node::diff(const Node &base, const Node &next) {
+    struct tasn1_node *delta{nullptr};
+    int erc{::tasn1_diff(base.node, next.node, &delta)};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
+    return Node(delta);
+}
+
+Node Node::decode(const vector_t &buffer) {
+    struct tasn1_node *res{nullptr};
+    int erc{::tasn1_decode(buffer.data(), buffer.size(), &res)};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
+    return Node(res);
+}
+
+Node Node::clone() const {
+    struct tasn1_node *res{::tasn1_clone(node)};
+    if (!res)
+        throw std::runtime_error("Unable to clone node");
+    return Node(res);
+}
+
+void Node::patch(Node &delta) {
+    if (contained)
+        throw std::runtime_error("Node is already contained");
+    delta.setContained();
+    int erc{::tasn1_patch(&node, delta.node)};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
+}
+
+void Node::patch(const vector_t &delta) {
+    if (contained)
+        throw std::runtime_error("Node is already contained");
+    int erc{::tasn1_patch_encoded(&node, delta.data(), delta.size())};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
+}
+
+void Node::canonicalize() {
+    int erc{::tasn1_canonicalize(node)};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
+}
+
+uint64_t Node::hash() const {
+    uint64_t res{0};
+    int erc{::tasn1_hash(node, &res)};
+    if (erc < 0)
+        throw std::runtime_error("SYS error " + std::to_string(erc));
+    return res;
+}
+
+// Resize buffer to the size of node plus extra octets and fill it by
+// means of write, that gets the buffer and its size.
+static void serializeTo(struct tasn1_node *node, vector_t &buffer, size_t extra,
+                        const std::function<int(uint8_t *, size_t)> &write) {
     int n{::tasn1_size(node)};
     if (n < 0)
         throw std::runtime_error("SYS error " + std::to_string(n));
+    n += extra;
     buffer.resize(n);
-    int m{::tasn1_serialize(node, buffer.data(), n)};
+    int m{write(buffer.data(), buffer.size())};
     if (m < 0)
-        throw std::runtime_error("IO error " + std::to_string(n));
+        throw std::runtime_error("IO error " + std::to_string(m));
     if (m != n)
         throw std::runtime_error("Size inconsistency " + std::to_string(n) + " <-> " + std::to_string(m));
 }
 
+void Node::serializeFramed(vector_t &buffer) {
+    serializeTo(node, buffer, TASN1_CRC_SIZE, [this](uint8_t *po, size_t co) {
+        return ::tasn1_serialize_framed(node, po, co);
+    });
+}
+
+void Node::serialize(vector_t &buffer) {
+    serializeTo(node, buffer, 0, [this](uint8_t *po, size_t co) {
+        return ::tasn1_serialize(node, po, co);
+    });
+}
+
+void Node::serialize(vector_t &buffer, uint64_t &hash) {
+    serializeTo(node, buffer, 0, [this, &hash](uint8_t *po, size_t co) {
+        return ::tasn1_serialize_hash(node, po, co, &hash);
+    });
+}
+
 } // end namespace tasn1 //
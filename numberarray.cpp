@@ -0,0 +1,26 @@
+#include "tasn1/numberarray.hpp"
+#include "tasn1/tasn1.h"
+
+namespace tasn1 {
+
+NumberArray::NumberArray(const int16_t *pn, size_t cn):
+    Node(::tasn1_new_number_array(pn, cn, true))
+{
+}
+
+NumberArray::NumberArray(const std::vector<int16_t> &v):
+    Node(::tasn1_new_number_array(v.data(), v.size(), true))
+{
+}
+
+const int16_t *NumberArray::data() const {
+    return ::tasn1_number_array_data(node, nullptr);
+}
+
+size_t NumberArray::size() const {
+    size_t cn{0};
+    ::tasn1_number_array_data(node, &cn);
+    return cn;
+}
+
+} // end namespace tasn1 //
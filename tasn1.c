@@ -1,14 +1,38 @@
 #include "tasn1.h"
+#include "crc32c.h"
 
 #include <errno.h>
-#include <clist.h>
 #include <limits.h>
+#include <stdlib.h>
 
 tasn1_node_t {
-    tasn1_type_t type;
-    struct list_head list;
+    uint8_t type; // tasn1_type_t
 };
 
+/*
+ * Numbers and short octet sequences are not allocated, but stored in the
+ * node pointer itself. Such a tagged word has bit 0 set, bit 1 tells
+ * numbers from octet sequences. Numbers keep their value in bits 8..23,
+ * octet sequences their length in bits 2..7 and their octets in the
+ * following bytes, starting at bits 8..15.
+ */
+#define TAG_BIT        ((uintptr_t)0x01)
+#define TAG_MASK       ((uintptr_t)0x03)
+#define TAG_NUMBER     ((uintptr_t)0x01)
+#define TAG_OCTETS     ((uintptr_t)0x03)
+#define INLINE_OCTETS  (sizeof(uintptr_t) - 1)
+
+static bool is_tagged(const tasn1_node_t *node) {
+    return ((uintptr_t)node & TAG_BIT) != 0;
+}
+
+static tasn1_type_t node_type(const tasn1_node_t *node) {
+    uintptr_t word = (uintptr_t)node;
+    if (word & TAG_BIT)
+        return ((word & TAG_MASK) == TAG_OCTETS) ? TASN1_OCTET_SEQUENCE_T : TASN1_NUMBER_T;
+    return (tasn1_type_t)node->type;
+}
+
 static int serialize_header(tasn1_type_t type, size_t size, TASN1_OCTET *po, size_t co) {
     if (size < 32) {
         if (co < 1)
@@ -38,10 +62,51 @@ static int serialize_header(tasn1_type_t type, size_t size, TASN1_OCTET *po, siz
     }
 }
 
+/*
+ * Counterpart of serialize_header(). Numbers carry their value in place
+ * of the length, so their content size is always 0. Returns the number of
+ * header octets, 0 if co is too short or a negative error code.
+ */
+static int parse_header(const TASN1_OCTET *po, size_t co, tasn1_type_t *type, size_t *size) {
+    if (co < 1)
+        return 0;
+    TASN1_OCTET o = *po;
+    *type = (tasn1_type_t)((o >> 5) & 0x03);
+    size_t n = o & 0x1f;
+    if (!(o & 0x80)) {
+        *size = (*type == TASN1_NUMBER_T) ? 0 : n;
+        return 1;
+    }
+    if (n < 1 || n > 2)
+        return -EINVAL;
+    if (*type == TASN1_NUMBER_T) {
+        *size = 0;
+        return 1 + n;
+    }
+    if (co < 1 + n)
+        return 0;
+    *size = (n == 1) ? po[1] : (po[1] * 256 + po[2]);
+    return 1 + n;
+}
+
+int tasn1_peek_size(const TASN1_OCTET *po, size_t co) {
+    if (!po)
+        return -EINVAL;
+    tasn1_type_t type;
+    size_t size;
+    int n = parse_header(po, co, &type, &size);
+    if (n <= 0)
+        return n;
+    return n + size;
+}
+
+/*
+ * Octet sequences that don't fit into a tagged word.
+ */
 struct octet_sequence {
     tasn1_node_t node_base;
-    size_t size;
     bool is_copy;
+    uint16_t size;
     union {
         const TASN1_OCTET *p_data;
         TASN1_OCTET data[0];
@@ -50,14 +115,19 @@ struct octet_sequence {
 #define octet_sequence_t struct octet_sequence
 
 tasn1_node_t *tasn1_new_octet_sequence(const TASN1_OCTET *po, size_t co, bool copy) {
+    if (co > USHRT_MAX - 3)
+        return NULL;
+    if (copy && co <= INLINE_OCTETS) {
+        uintptr_t word = TAG_OCTETS | (co << 2);
+        for (size_t i = 0; i < co; ++i)
+            word |= (uintptr_t)po[i] << (8 * (i + 1));
+        return (tasn1_node_t *)word;
+    }
     size_t sz = sizeof(octet_sequence_t) + (copy ? co : 0);
     octet_sequence_t *res = malloc(sz);
     if (!res)
         return NULL;
     res->node_base.type = TASN1_OCTET_SEQUENCE_T;
-    INIT_LIST_HEAD(&res->node_base.list);
-    if (co > USHRT_MAX - 3) 
-        return NULL;
     res->size = co;
     res->is_copy = copy;
     if (copy) {
@@ -68,346 +138,1669 @@ tasn1_node_t *tasn1_new_octet_sequence(const TASN1_OCTET *po, size_t co, bool co
     return (tasn1_node_t *)res;
 }
 
-static void octet_sequence_free(octet_sequence_t *it) {
-    free(it);
+/*
+ * Get the octets of an octet sequence. Inline octets are unpacked to buf,
+ * that has to hold INLINE_OCTETS octets.
+ */
+static const TASN1_OCTET *get_octets(const tasn1_node_t *node, TASN1_OCTET *buf, size_t *size) {
+    if (is_tagged(node)) {
+        uintptr_t word = (uintptr_t)node;
+        *size = (word >> 2) & 0x3f;
+        for (size_t i = 0; i < *size; ++i)
+            buf[i] = (TASN1_OCTET)(word >> (8 * (i + 1)));
+        return buf;
+    }
+    const octet_sequence_t *it = (const octet_sequence_t *)node;
+    *size = it->size;
+    return it->is_copy ? it->data : it->p_data;
 }
 
-static int serialize_octet_sequence(const octet_sequence_t *it, TASN1_OCTET *po, size_t co) {
-    if (!it)
-        return -EINVAL;
-    int n = serialize_header(TASN1_OCTET_SEQUENCE_T, it->size, po, co);
+static int serialize_octet_sequence(const tasn1_node_t *node, TASN1_OCTET *po, size_t co) {
+    TASN1_OCTET buf[INLINE_OCTETS];
+    size_t size;
+    const TASN1_OCTET *src = get_octets(node, buf, &size);
+    int n = serialize_header(TASN1_OCTET_SEQUENCE_T, size, po, co);
     if (n < 0)
         return n;
     if (po)
         po += n;
-    if ((int)co < n)
-        return -ENOMEM;
     co -= n;
-    if (co < it->size)
+    if (co < size)
         return -ENOMEM;
-    const TASN1_OCTET *src = (it->is_copy ? it->data : it->p_data);
     if (po)
-        memcpy(po, src, it->size);
-    if (co < it->size)
-        return -ENOMEM;
-    return n + it->size;
+        memcpy(po, src, size);
+    return n + size;
+}
+
+/*
+ * Order of keys in indexed maps: octet by octet, a prefix first.
+ */
+static int compare_octets(const TASN1_OCTET *pa, size_t ca, const TASN1_OCTET *pb, size_t cb) {
+    int res = memcmp(pa, pb, (ca < cb) ? ca : cb);
+    if (res != 0)
+        return res;
+    return (ca < cb) ? -1 : (ca > cb) ? 1 : 0;
 }
 
+static int compare_keys(const tasn1_node_t *a, const tasn1_node_t *b) {
+    TASN1_OCTET buf_a[INLINE_OCTETS], buf_b[INLINE_OCTETS];
+    size_t ca, cb;
+    const TASN1_OCTET *pa = get_octets(a, buf_a, &ca);
+    const TASN1_OCTET *pb = get_octets(b, buf_b, &cb);
+    return compare_octets(pa, ca, pb, cb);
+}
+
+/*
+ * Make room for one more element of a vector that grows by doubling.
+ * Returns the possibly moved elements or NULL, when out of memory.
+ */
+static void *reserve(void *elems, size_t *capacity, size_t count, size_t elem_size) {
+    if (count < *capacity)
+        return elems;
+    size_t n = (*capacity > 0) ? 2 * *capacity : 4;
+    void *res = realloc(elems, n * elem_size);
+    if (res)
+        *capacity = n;
+    return res;
+}
+
+struct item {
+    tasn1_node_t *p_key;
+    tasn1_node_t *p_val;
+};
+#define item_t struct item
+
 struct map {
     tasn1_node_t node_base;
-    struct list_head children;
+    bool indexed;
+    size_t count;
+    size_t capacity;
+    item_t *items;
+    tasn1_node_t *p_pending; // Work list of tasn1_free()
 };
 #define map_t struct map
 
-tasn1_node_t *tasn1_new_map() {
+static tasn1_node_t *new_map(bool indexed) {
     map_t *res = malloc(sizeof(map_t));
     if (!res)
         return NULL;
     res->node_base.type = TASN1_MAP_T;
-    INIT_LIST_HEAD(&res->node_base.list);
-    INIT_LIST_HEAD(&res->children);
+    res->indexed = indexed;
+    res->count = 0;
+    res->capacity = 0;
+    res->items = NULL;
+    res->p_pending = NULL;
     return (tasn1_node_t *)res;
 }
 
-struct item {
-    struct list_head list;
-    tasn1_node_t *p_key;
-    tasn1_node_t *p_val;
-};
-#define item_t struct item
+tasn1_node_t *tasn1_new_map() {
+    return new_map(false);
+}
 
-static item_t *new_item(tasn1_node_t *key, tasn1_node_t *val) {
-    item_t *res = malloc(sizeof(item_t));
-    if (!res)
-        return NULL;
-    INIT_LIST_HEAD(&res->list);
-    res->p_key = key;
-    res->p_val = val;
-    return res;
+tasn1_node_t *tasn1_new_indexed_map() {
+    return new_map(true);
 }
 
-static int serialize_item(const item_t *it, TASN1_OCTET *po, size_t co) {
-    if (!it)
+/*
+ * The empty key marks the index of an indexed map, see serialize_index().
+ */
+static bool is_empty_key(const tasn1_node_t *key) {
+    TASN1_OCTET buf[INLINE_OCTETS];
+    size_t size;
+    if (node_type(key) != TASN1_OCTET_SEQUENCE_T)
+        return false;
+    get_octets(key, buf, &size);
+    return size == 0;
+}
+
+int tasn1_add_map_item(tasn1_node_t *map,  tasn1_node_t *key, tasn1_node_t *val) {
+    if (!map)
         return -ENOENT;
-    int n = tasn1_serialize(it->p_key, po, co);
-    if (n < 0)
-        return n;
-    if (po)
-        po += n;
-    if ((int)co < n)
+    if (!(key && val))
+        return -ENOENT;
+    if (node_type(map) != TASN1_MAP_T)
+        return -EINVAL;
+    if (is_empty_key(key))
+        return -EINVAL;
+    map_t *it = (map_t *)map;
+    size_t index = it->count;
+    if (it->indexed) {
+        // Indexed maps keep their items sorted by key:
+        if (node_type(key) != TASN1_OCTET_SEQUENCE_T)
+            return -EINVAL;
+        size_t lo = 0;
+        while (lo < index) {
+            size_t mid = (lo + index) / 2;
+            if (compare_keys(key, it->items[mid].p_key) < 0)
+                index = mid;
+            else
+                lo = mid + 1;
+        }
+    }
+    item_t *items = reserve(it->items, &it->capacity, it->count, sizeof(item_t));
+    if (!items)
         return -ENOMEM;
-    co -= n;
-    int m = tasn1_serialize(it->p_val, po, co);
-    if (m < 0)
-        return m;
-    return n + m;
+    it->items = items;
+    memmove(&items[index + 1], &items[index], (it->count - index) * sizeof(item_t));
+    items[index].p_key = key;
+    items[index].p_val = val;
+    ++it->count;
+    return 0;
+}
+
+/*
+ * Parse the octet sequence at po. Returns its size or a negative error code.
+ */
+static int parse_octets(const TASN1_OCTET *po, size_t co, const TASN1_OCTET **pv, size_t *cv) {
+    tasn1_type_t type;
+    size_t size;
+    int n = parse_header(po, co, &type, &size);
+    if (n <= 0 || type != TASN1_OCTET_SEQUENCE_T || co < n + size)
+        return -EINVAL;
+    *pv = po + n;
+    *cv = size;
+    return n + size;
 }
 
-static int map_size_without_header(const map_t *it) {
-    if (!it)
+static int value_at(const TASN1_OCTET *po, size_t co, const TASN1_OCTET **val) {
+    int n = tasn1_peek_size(po, co);
+    if (n <= 0 || (size_t)n > co)
+        return -EINVAL;
+    *val = po;
+    return n;
+}
+
+int tasn1_map_lookup(const TASN1_OCTET *po, size_t co,
+                     const TASN1_OCTET *pk, size_t ck, const TASN1_OCTET **val)
+{
+    tasn1_type_t type;
+    size_t size;
+    const TASN1_OCTET *pm;
+    size_t cm;
+    int n, m;
+
+    if (!po || !pk || !val)
+        return -EINVAL;
+    n = parse_header(po, co, &type, &size);
+    if (n <= 0 || type != TASN1_MAP_T || co < n + size)
+        return -EINVAL;
+    const TASN1_OCTET *content = po + n;
+    const TASN1_OCTET *end = content + size;
+
+    n = (size > 0) ? parse_octets(content, size, &pm, &cm) : 0;
+    if (n < 0)
+        return n;
+    if (n > 0 && cm == 0) {
+        // Indexed map: binary search in the table of item offsets
+        const TASN1_OCTET *table;
+        size_t lo = 0, hi;
+        m = parse_octets(content + n, size - n, &table, &hi);
+        if (m < 0)
+            return m;
+        hi /= 2;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            size_t offset = table[2 * mid] * 256 + table[2 * mid + 1];
+            if (offset >= size)
+                return -EINVAL;
+            m = parse_octets(content + offset, size - offset, &pm, &cm);
+            if (m < 0)
+                return m;
+            int cmp = compare_octets(pk, ck, pm, cm);
+            if (cmp == 0)
+                return value_at(content + offset + m, size - offset - m, val);
+            if (cmp < 0)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
         return -ENOENT;
+    }
 
-    struct list_head *pos;
-    item_t *current_item;
-    int n = 0, m;
-    list_for_each(pos, &it->children) {
-        current_item = list_entry(pos, item_t, list);
-        m = serialize_item(current_item, NULL, 65536);
+    // Plain map: scan item by item
+    for (const TASN1_OCTET *p = content; p < end; p += m) {
+        n = parse_octets(p, end - p, &pm, &cm);
+        if (n < 0)
+            return n;
+        p += n;
+        m = value_at(p, end - p, val);
         if (m < 0)
             return m;
-        n += m;
+        if (compare_octets(pk, ck, pm, cm) == 0)
+            return m;
     }
-    return n;
+    return -ENOENT;
+}
+
+struct array {
+    tasn1_node_t node_base;
+    size_t count;
+    size_t capacity;
+    tasn1_node_t **values;
+    tasn1_node_t *p_pending; // Work list of tasn1_free()
+};
+#define array_t struct array
+
+tasn1_node_t *tasn1_new_array() {
+    array_t *res = malloc(sizeof(array_t));
+    if (!res)
+        return NULL;
+    res->node_base.type = TASN1_ARRAY_T;
+    res->count = 0;
+    res->capacity = 0;
+    res->values = NULL;
+    res->p_pending = NULL;
+    return (tasn1_node_t *)res;
 }
 
-static int serialize_map(const map_t *it, TASN1_OCTET *po, size_t co) {
-    if (!it)
+int tasn1_add_array_value(tasn1_node_t *array, tasn1_node_t *val) {
+    if (!array)
+        return -ENOMEM;
+    if (!val)
         return -ENOENT;
-    int size = map_size_without_header(it);
-    if (size < 0)
-        return size;
-    int n = serialize_header(TASN1_MAP_T, size, po, co);
-    if (n < 0)
-        return n;
-    if (po)
-        po += n;
-    if ((int)co < n)
+    if (node_type(array) != TASN1_ARRAY_T)
+        return -EINVAL;
+    array_t *it = (array_t *)array;
+    tasn1_node_t **values = reserve(it->values, &it->capacity, it->count, sizeof(tasn1_node_t *));
+    if (!values)
         return -ENOMEM;
-    co -= n;
+    it->values = values;
+    values[it->count++] = val;
+    return 0;
+}
 
-    struct list_head *pos;
-    item_t *current_item;
-    int m;
-    list_for_each(pos, &it->children) {
-        current_item = list_entry(pos, item_t, list);
-        m = serialize_item(current_item, po, co);
-        if (m < 0)
-            return m;
+tasn1_node_t *tasn1_new_number(TASN1_NUMBER n) {
+    return (tasn1_node_t *)(TAG_NUMBER | ((uintptr_t)(uint16_t)n << 8));
+}
+
+static TASN1_NUMBER get_number(const tasn1_node_t *node) {
+    return (TASN1_NUMBER)(uint16_t)((uintptr_t)node >> 8);
+}
+
+static int serialize_number(TASN1_NUMBER number, TASN1_OCTET *po, size_t co) {
+    // Negative numbers are written as two octets two's complement:
+    uint16_t val = (uint16_t)number;
+    if (val < 32) {
+        if (co < 1)
+            return -ENOMEM;
         if (po)
-            po += m;
-        if ((int)co < m)
+            *po = 0x00 | (TASN1_NUMBER_T << 5) | val;
+        return 1;
+    } else if (val < 256) {
+        if (co < 2)
             return -ENOMEM;
-        if ((int)co < m)
+        if (po) {
+            *po++ = 0x80 | (TASN1_NUMBER_T << 5) | 0x01;
+            *po = val;
+        }
+        return 2;
+    } else {
+        if (co < 3)
             return -ENOMEM;
-        co -= m;
-        n += m;
+        if (po) {
+            *po++ = 0x80 | (TASN1_NUMBER_T << 5) | 0x02;
+            *po++ = val >> 8;
+            *po = val & 0xff;
+        }
+        return 3;
     }
-
-    return n;
 }
 
-static void item_free(item_t *it) {
-    if (it) {
-        tasn1_free(it->p_key);
-        tasn1_free(it->p_val);
-        free(it);
+struct number_array {
+    tasn1_node_t node_base;
+    bool is_copy;
+    size_t count;
+    union {
+        const TASN1_NUMBER *p_data;
+        TASN1_NUMBER data[0];
+    };
+};
+#define number_array_t struct number_array
+
+tasn1_node_t *tasn1_new_number_array(const TASN1_NUMBER *pn, size_t cn, bool copy) {
+    if (cn > USHRT_MAX - 3)
+        return NULL;
+    size_t sz = sizeof(number_array_t) + (copy ? cn * sizeof(TASN1_NUMBER) : 0);
+    number_array_t *res = malloc(sz);
+    if (!res)
+        return NULL;
+    res->node_base.type = TASN1_NUMBER_ARRAY_T;
+    res->count = cn;
+    res->is_copy = copy;
+    if (copy) {
+        memcpy(res->data, pn, cn * sizeof(TASN1_NUMBER));
+    } else {
+        res->p_data = pn;
     }
+    return (tasn1_node_t *)res;
 }
 
-static void map_free(map_t *it) {
-    if (it) {
-        struct list_head *pos;
-        struct list_head *n;
-        item_t *current_item;
-
-        list_for_each_safe(pos, n, &it->children) {
-            current_item = list_entry(pos, item_t, list);
-            item_free(current_item);
-        }
-        free(it);
-    }
+const TASN1_NUMBER *tasn1_number_array_data(const tasn1_node_t *node, size_t *cn) {
+    if (!node || node_type(node) != TASN1_NUMBER_ARRAY_T)
+        return NULL;
+    const number_array_t *it = (const number_array_t *)node;
+    if (cn)
+        *cn = it->count;
+    return it->is_copy ? it->data : it->p_data;
 }
 
-int tasn1_add_map_item(tasn1_node_t *map,  tasn1_node_t *key, tasn1_node_t *val) {
-    if (!map)
-        return -ENOENT;
-    if (!(key && val))
-        return -ENOENT;
-    if (map->type != TASN1_MAP_T)
-        return -EINVAL;
-    list_add_tail(&new_item(key, val)->list, &((map_t *)map)->children);
-    return 0;
+/*
+ * The elements are encoded exactly like single numbers, so the result is
+ * an ordinary array. Both loops are free of branches and vectorize well;
+ * the general loop is only needed when some element exceeds the short form.
+ */
+static int serialize_number_array(const number_array_t *it, TASN1_OCTET *po, size_t co) {
+    const TASN1_NUMBER *src = it->is_copy ? it->data : it->p_data;
+    const size_t count = it->count;
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t val = (uint16_t)src[i];
+        size += 1 + (val >= 32) + (val >= 256);
+    }
+    int n = serialize_header(TASN1_ARRAY_T, size, po, co);
+    if (n < 0)
+        return n;
+    if (co < (size_t)n + size)
+        return -ENOMEM;
+    if (!po)
+        return n + size;
+    po += n;
+    if (size == count) {
+        for (size_t i = 0; i < count; ++i)
+            po[i] = 0x00 | (TASN1_NUMBER_T << 5) | (TASN1_OCTET)src[i];
+    } else {
+        for (size_t i = 0; i < count; ++i)
+            po += serialize_number(src[i], po, 3);
+    }
+    return n + size;
 }
 
-struct array {
+struct frozen {
     tasn1_node_t node_base;
-    struct list_head children;
+    size_t refs;
+    size_t size;
+    uint64_t hash; // Of data, see tasn1_hash()
+    TASN1_OCTET data[0];
 };
-#define array_t struct array
+#define frozen_t struct frozen
 
-tasn1_node_t *tasn1_new_array() {
-    array_t *res = malloc(sizeof(array_t));
+tasn1_node_t *tasn1_freeze(tasn1_node_t *node) {
+    if (!node)
+        return NULL;
+    if (node_type(node) == TASN1_FROZEN_T)
+        return node;
+    int size = tasn1_size(node);
+    if (size < 0)
+        return NULL;
+    frozen_t *res = malloc(sizeof(frozen_t) + size);
     if (!res)
         return NULL;
-    res->node_base.type = TASN1_ARRAY_T;
-    INIT_LIST_HEAD(&res->node_base.list);
-    INIT_LIST_HEAD(&res->children);
+    res->node_base.type = TASN1_FROZEN_T;
+    res->refs = 1;
+    res->size = size;
+    if (tasn1_serialize_hash(node, res->data, size, &res->hash) != size) {
+        free(res);
+        return NULL;
+    }
+    tasn1_free(node);
     return (tasn1_node_t *)res;
 }
 
-static void array_free(array_t *it) {
-    if (it) {
-        struct list_head *pos;
-        struct list_head *n;
-        tasn1_node_t *current_node;
+tasn1_node_t *tasn1_share(const tasn1_node_t *frozen) {
+    if (!frozen || node_type(frozen) != TASN1_FROZEN_T)
+        return NULL;
+    frozen_t *it = (frozen_t *)frozen;
+    ++it->refs;
+    return (tasn1_node_t *)it;
+}
+
+static int serialize_frozen(const frozen_t *it, TASN1_OCTET *po, size_t co) {
+    if (co < it->size)
+        return -ENOMEM;
+    if (po)
+        memcpy(po, it->data, it->size);
+    return it->size;
+}
+
+static int serialize_leaf(const tasn1_node_t *node, TASN1_OCTET *po, size_t co) {
+    switch (node_type(node)) {
+        case TASN1_OCTET_SEQUENCE_T:
+            return serialize_octet_sequence(node, po, co);
+        case TASN1_NUMBER_T:
+            return serialize_number(get_number(node), po, co);
+        case TASN1_NUMBER_ARRAY_T:
+            return serialize_number_array((number_array_t *)node, po, co);
+        case TASN1_FROZEN_T:
+            return serialize_frozen((frozen_t *)node, po, co);
+        default:
+            return -EINVAL;
+    } // end switch //
+}
+
+/*
+ * Traversal state of one map or array. Maps are walked as the flat
+ * sequence key, value, key, value, ...
+ */
+struct tasn1_frame {
+    const tasn1_node_t *node;
+    size_t index;
+    bool val_next;
+    int size;
+    size_t seq;                 // Position in content_sizes_t
+    const TASN1_OCTET *content; // Indexed maps only
+    TASN1_OCTET *table;         // Indexed maps only
+};
+#define frame_t struct tasn1_frame
+
+static bool is_container(const tasn1_node_t *node) {
+    tasn1_type_t type = node_type(node);
+    return (type == TASN1_MAP_T) || (type == TASN1_ARRAY_T);
+}
+
+static void push_frame(frame_t *frame, const tasn1_node_t *node) {
+    frame->node = node;
+    frame->index = 0;
+    frame->val_next = false;
+    frame->size = 0;
+    frame->seq = 0;
+    frame->content = NULL;
+    frame->table = NULL;
+}
+
+/*
+ * Make room for one more entry of a work stack that starts on the call
+ * stack and moves to the heap when it grows. Returns the possibly moved
+ * stack or NULL, when out of memory.
+ */
+static void *grow_stack(void *stack, const void *local, size_t *depth, size_t elem_size) {
+    size_t n = 2 * *depth;
+    void *res;
+    if (stack == local) {
+        res = malloc(n * elem_size);
+        if (res)
+            memcpy(res, local, *depth * elem_size);
+    } else {
+        res = realloc(stack, n * elem_size);
+    }
+    if (res)
+        *depth = n;
+    return res;
+}
+
+static bool is_indexed(const tasn1_node_t *node) {
+    return (node_type(node) == TASN1_MAP_T) && ((const map_t *)node)->indexed;
+}
 
-        list_for_each_safe(pos, n, &it->children) {
-            current_node = list_entry(pos, tasn1_node_t, list);
-            tasn1_free(current_node);
+/*
+ * Indexed maps start with an item that has an empty key and the table of
+ * item offsets as value. The offsets are filled in while writing the items.
+ */
+static int serialize_index(const map_t *it, TASN1_OCTET *po, size_t co, TASN1_OCTET **table) {
+    size_t size = 2 * it->count;
+    if (co < 1)
+        return -ENOMEM;
+    int n = serialize_header(TASN1_OCTET_SEQUENCE_T, size, po ? po + 1 : NULL, co - 1);
+    if (n < 0)
+        return n;
+    if (co < 1 + n + size)
+        return -ENOMEM;
+    if (po) {
+        *po = 0x00 | (TASN1_OCTET_SEQUENCE_T << 5);
+        *table = po + 1 + n;
+    }
+    return 1 + n + size;
+}
+
+/*
+ * Get the next child of the container in frame. Returns NULL when the
+ * container is exhausted, sets *erc when a child is missing.
+ */
+static const tasn1_node_t *next_child(frame_t *frame, int *erc) {
+    const tasn1_node_t *res;
+    if (frame->node->type == TASN1_ARRAY_T) {
+        const array_t *it = (const array_t *)frame->node;
+        if (frame->index == it->count)
+            return NULL;
+        res = it->values[frame->index++];
+    } else {
+        const map_t *it = (const map_t *)frame->node;
+        if (frame->val_next) {
+            res = it->items[frame->index++].p_val;
+            frame->val_next = false;
+        } else {
+            if (frame->index == it->count)
+                return NULL;
+            res = it->items[frame->index].p_key;
+            frame->val_next = true;
         }
-        free(it);
     }
+    if (!res)
+        *erc = -ENOENT;
+    return res;
 }
 
-static int array_size_without_header(const array_t *it) {
-    if (!it)
+/*
+ * Content sizes of all maps and arrays in pre order, collected by
+ * walk_size() for walk_serialize(). They are kept out of the nodes, so
+ * that serializing never modifies the tree. The traversal stack is shared
+ * with the frames: frames from its start, content sizes down from its end.
+ */
+struct content_sizes {
+    uint16_t *end; // Content size i is at end[-1 - i]
+    size_t count;
+};
+#define content_sizes_t struct content_sizes
+
+/*
+ * Post order walk that calculates the size of node. When sizes is given,
+ * the content size of every map and array is stored on the way.
+ */
+static int walk_size(const tasn1_node_t *node, frame_t *stack, size_t stack_size,
+                     content_sizes_t *sizes)
+{
+    size_t top = 0;
+    int erc = 0;
+    int n;
+
+    if (!node)
         return -ENOENT;
+    for (;;) {
+        if (is_container(node)) {
+            size_t used = (top + 1) * sizeof(frame_t);
+            if (sizes)
+                used += (sizes->count + 1) * sizeof(uint16_t);
+            if (used > stack_size)
+                return -ELOOP;
+            push_frame(&stack[top++], node);
+            if (sizes)
+                stack[top - 1].seq = sizes->count++;
+            if (is_indexed(node)) {
+                n = serialize_index((const map_t *)node, NULL, 65536, NULL);
+                if (n < 0)
+                    return n;
+                stack[top - 1].size = n;
+            }
+        } else {
+            n = serialize_leaf(node, NULL, 65536);
+            if (n < 0)
+                return n;
+            if (top == 0)
+                return n;
+            stack[top - 1].size += n;
+        }
+        for (;;) {
+            frame_t *frame = &stack[top - 1];
+            if (frame->size >= 65536)
+                return -ENOMEM;
+            node = next_child(frame, &erc);
+            if (erc < 0)
+                return erc;
+            if (node)
+                break;
+            if (sizes)
+                *(sizes->end - 1 - frame->seq) = frame->size;
+            n = serialize_header(frame->node->type, frame->size, NULL, 3);
+            if (n < 0)
+                return n;
+            n += frame->size;
+            if (--top == 0)
+                return n;
+            stack[top - 1].size += n;
+        }
+    }
+}
 
-    struct list_head *pos;
-    tasn1_node_t *current_node;
+/*
+ * FNV-1a, 64 bit.
+ */
+#define HASH_INIT  UINT64_C(0xcbf29ce484222325)
+#define HASH_PRIME UINT64_C(0x00000100000001b3)
 
-    int n = 0, m;
-    list_for_each(pos, &it->children) {
-        current_node = list_entry(pos, tasn1_node_t, list);
-        m = tasn1_serialize(current_node, NULL, 65536);
-        if (m < 0)
-            return m;
-        n += m;
+static uint64_t hash_octets(uint64_t hash, const TASN1_OCTET *po, size_t co) {
+    for (size_t i = 0; i < co; ++i) {
+        hash ^= po[i];
+        hash *= HASH_PRIME;
     }
+    return hash;
+}
 
-    return n;
+/*
+ * Hash or checksum of the octets written by walk_serialize().
+ */
+enum digest_kind { DIGEST_FNV1A, DIGEST_CRC32C };
+
+struct digest {
+    enum digest_kind kind;
+    uint64_t value;
+};
+#define digest_t struct digest
+
+static void digest_update(digest_t *digest, const TASN1_OCTET *po, size_t co) {
+    if (digest->kind == DIGEST_FNV1A)
+        digest->value = hash_octets(digest->value, po, co);
+    else
+        digest->value = tasn1_crc32c_update((uint32_t)digest->value, po, co);
 }
 
-static int serialize_array(const array_t *it, TASN1_OCTET *po, size_t co) {
-    if (!it)
-        return -ENOENT;
-    int size = array_size_without_header(it);
-    if (size < 0)
-        return size;
-    int n = serialize_header(TASN1_MAP_T, size, po, co);
-    if (n < 0)
-        return n;
-    if (po)
+/*
+ * Pre order walk that writes node. Requires the content sizes collected
+ * by walk_size(), read down from sizes. When digest is given, the written octets are digested right
+ * behind the write position. Only the offset tables of indexed maps are
+ * completed later, so the map is digested when it is closed.
+ */
+static int walk_serialize(const tasn1_node_t *node, TASN1_OCTET *po, size_t co,
+                          frame_t *stack, size_t depth, const uint16_t *sizes,
+                          digest_t *digest)
+{
+    size_t top = 0;
+    size_t left = co;
+    size_t deferred = 0; // Open indexed maps
+    const TASN1_OCTET *hashed = po;
+    int erc = 0;
+    int n;
+
+    for (;;) {
+        if (is_container(node)) {
+            if (top == depth)
+                return -ELOOP;
+            n = serialize_header(node->type, *--sizes, po, left);
+            if (n < 0)
+                return n;
+            frame_t *frame = &stack[top++];
+            push_frame(frame, node);
+            if (is_indexed(node)) {
+                frame->content = po + n;
+                int m = serialize_index((const map_t *)node, po + n, left - n, &frame->table);
+                if (m < 0)
+                    return m;
+                n += m;
+                ++deferred;
+            }
+        } else {
+            n = serialize_leaf(node, po, left);
+            if (n < 0)
+                return n;
+        }
         po += n;
-    if ((int)co < n)
+        left -= n;
+        for (;;) {
+            if (digest && deferred == 0) {
+                digest_update(digest, hashed, po - hashed);
+                hashed = po;
+            }
+            if (top == 0)
+                return co - left;
+            frame_t *frame = &stack[top - 1];
+            node = next_child(frame, &erc);
+            if (erc < 0)
+                return erc;
+            if (node) {
+                // A key starts the next item of an indexed map:
+                if (frame->table && frame->val_next) {
+                    size_t offset = po - frame->content;
+                    *frame->table++ = offset >> 8;
+                    *frame->table++ = offset & 0xff;
+                }
+                break;
+            }
+            if (frame->content)
+                --deferred;
+            --top;
+        }
+    }
+}
+
+size_t tasn1_stack_size(size_t depth, size_t containers) {
+    return depth * sizeof(frame_t) + containers * sizeof(uint16_t);
+}
+
+int tasn1_size_ex(const tasn1_node_t *node, void *stack, size_t stack_size) {
+    if (!stack)
+        return -EINVAL;
+    return walk_size(node, (frame_t *)stack, stack_size, NULL);
+}
+
+static int serialize_ex(const tasn1_node_t *node, TASN1_OCTET *po, size_t co,
+                        void *stack, size_t stack_size, digest_t *digest)
+{
+    if (!stack)
+        return -EINVAL;
+    stack_size -= stack_size % sizeof(uint16_t);
+    content_sizes_t sizes = { (uint16_t *)stack + stack_size / sizeof(uint16_t), 0 };
+    int n = walk_size(node, (frame_t *)stack, stack_size, po ? &sizes : NULL);
+    if (n < 0 || !po)
+        return n;
+    if (co < (size_t)n)
         return -ENOMEM;
-    co -= n;
-    struct list_head *pos;
-    tasn1_node_t *current_node;
+    size_t depth = (stack_size - sizes.count * sizeof(uint16_t)) / sizeof(frame_t);
+    return walk_serialize(node, po, co, (frame_t *)stack, depth, sizes.end, digest);
+}
 
-    list_for_each(pos, &it->children) {
-        current_node = list_entry(pos, tasn1_node_t, list);
-        int m = tasn1_serialize(current_node, po, co);
-        if (m < 0)
-            return m;
-        if (po)
-            po += m;
-        if ((int)co < m)
-            return -ENOMEM;
-        co -= m;
-        n += m;
+int tasn1_serialize_ex(const tasn1_node_t *node, TASN1_OCTET *po, size_t co,
+                       void *stack, size_t stack_size)
+{
+    return serialize_ex(node, po, co, stack, stack_size, NULL);
+}
+
+/*
+ * Nesting depth and number of maps and arrays of node, walked with a
+ * stack that grows on the heap.
+ */
+static int measure(const tasn1_node_t *node, size_t *depth, size_t *containers) {
+    frame_t local[TASN1_MAX_DEPTH];
+    frame_t *stack = local;
+    size_t capacity = TASN1_MAX_DEPTH;
+    size_t top = 0;
+    int erc = 0;
+
+    *depth = 0;
+    *containers = 0;
+    while (node) {
+        if (is_container(node)) {
+            if (top == capacity) {
+                frame_t *grown = grow_stack(stack, local, &capacity, sizeof(*stack));
+                if (!grown) {
+                    erc = -ENOMEM;
+                    break;
+                }
+                stack = grown;
+            }
+            push_frame(&stack[top++], node);
+            ++*containers;
+            if (top > *depth)
+                *depth = top;
+        }
+        node = NULL;
+        while (top > 0 && erc == 0 && !(node = next_child(&stack[top - 1], &erc)))
+            --top;
+        if (erc < 0)
+            break;
     }
+    if (stack != local)
+        free(stack);
+    return erc;
+}
 
+/*
+ * serialize_ex() with a stack on the call stack, that holds frames for
+ * TASN1_MAX_DEPTH levels and content sizes of hundreds of maps and arrays.
+ * Larger nodes are measured once and serialized with a stack of the exact
+ * size on the heap.
+ */
+static int serialize_any(const tasn1_node_t *node, TASN1_OCTET *po, size_t co, digest_t *digest) {
+    frame_t local[2 * TASN1_MAX_DEPTH];
+    size_t depth, containers;
+
+    int n = serialize_ex(node, po, co, local, sizeof(local), digest);
+    if (n != -ELOOP)
+        return n;
+    n = measure(node, &depth, &containers);
+    if (n < 0)
+        return n;
+    size_t stack_size = tasn1_stack_size(depth, po ? containers : 0);
+    void *heap = malloc(stack_size);
+    if (!heap)
+        return -ENOMEM;
+    n = serialize_ex(node, po, co, heap, stack_size, digest);
+    free(heap);
     return n;
 }
 
-int tasn1_add_array_value(tasn1_node_t *array, tasn1_node_t *val) {
-    if (!array)
+int tasn1_serialize(const tasn1_node_t *node, TASN1_OCTET *po, size_t co) {
+    return serialize_any(node, po, co, NULL);
+}
+
+int tasn1_size(const tasn1_node_t *node) {
+    return serialize_any(node, NULL, 0, NULL);
+}
+
+int tasn1_serialize_hash(const tasn1_node_t *node, TASN1_OCTET *po, size_t co, uint64_t *hash) {
+    digest_t digest = { DIGEST_FNV1A, HASH_INIT };
+    if (!po || !hash)
+        return -EINVAL;
+    int n = serialize_any(node, po, co, &digest);
+    *hash = digest.value;
+    return n;
+}
+
+int tasn1_hash(const tasn1_node_t *node, uint64_t *hash) {
+    if (!node || !hash)
+        return -EINVAL;
+    if (node_type(node) == TASN1_FROZEN_T) {
+        *hash = ((const frozen_t *)node)->hash;
+        return 0;
+    }
+    int n = tasn1_size(node);
+    if (n < 0)
+        return n;
+    TASN1_OCTET *po = malloc(n);
+    if (!po)
+        return -ENOMEM;
+    int m = tasn1_serialize_hash(node, po, n, hash);
+    free(po);
+    return (m < 0) ? m : 0;
+}
+
+int tasn1_serialize_framed(const tasn1_node_t *node, TASN1_OCTET *po, size_t co) {
+    digest_t digest = { DIGEST_CRC32C, CRC32C_INIT };
+    if (!po)
+        return -EINVAL;
+    if (co < TASN1_CRC_SIZE)
         return -ENOMEM;
+    int n = serialize_any(node, po, co - TASN1_CRC_SIZE, &digest);
+    if (n < 0)
+        return n;
+    uint32_t crc = ~(uint32_t)digest.value;
+    po += n;
+    *po++ = crc >> 24;
+    *po++ = (crc >> 16) & 0xff;
+    *po++ = (crc >> 8) & 0xff;
+    *po = crc & 0xff;
+    return n + TASN1_CRC_SIZE;
+}
+
+int tasn1_verify_framed(const TASN1_OCTET *po, size_t co, const TASN1_OCTET **val) {
     if (!val)
-        return -ENOENT;
-    if (array->type != TASN1_ARRAY_T)
         return -EINVAL;
-    list_add_tail(&val->list, &((array_t *)array)->children);
+    int n = tasn1_peek_size(po, co);
+    if (n <= 0)
+        return n;
+    if (co < (size_t)n + TASN1_CRC_SIZE)
+        return 0;
+    const TASN1_OCTET *trailer = po + n;
+    uint32_t crc = ~tasn1_crc32c_update(CRC32C_INIT, po, n);
+    uint32_t expected = (uint32_t)trailer[0] << 24 | (uint32_t)trailer[1] << 16 |
+                        (uint32_t)trailer[2] << 8 | trailer[3];
+    if (crc != expected)
+        return -EBADMSG;
+    *val = po;
+    return n;
+}
+
+/*
+ * Release a node without children, or put a map or array on the work
+ * list of tasn1_free().
+ */
+static void release(tasn1_node_t *node, tasn1_node_t **pending) {
+    if (!node || is_tagged(node))
+        return;
+    switch (node->type) {
+        case TASN1_MAP_T:
+            ((map_t *)node)->p_pending = *pending;
+            *pending = node;
+            return;
+        case TASN1_ARRAY_T:
+            ((array_t *)node)->p_pending = *pending;
+            *pending = node;
+            return;
+        case TASN1_FROZEN_T:
+            if (--((frozen_t *)node)->refs > 0)
+                return;
+            break;
+        default:
+            break;
+    } // end switch //
+    free(node);
+}
+
+/*
+ * Maps and arrays are released from a work list that is linked through
+ * the nodes themselves, so no stack is required at all.
+ */
+void tasn1_free(tasn1_node_t *node) {
+    tasn1_node_t *pending = NULL;
+
+    release(node, &pending);
+    while (pending) {
+        node = pending;
+        if (node->type == TASN1_MAP_T) {
+            map_t *it = (map_t *)node;
+            pending = it->p_pending;
+            for (size_t i = 0; i < it->count; ++i) {
+                release(it->items[i].p_key, &pending);
+                release(it->items[i].p_val, &pending);
+            }
+            free(it->items);
+        } else {
+            array_t *it = (array_t *)node;
+            pending = it->p_pending;
+            for (size_t i = 0; i < it->count; ++i)
+                release(it->values[i], &pending);
+            free(it->values);
+        }
+        free(node);
+    }
+}
+
+static bool nodes_equal(const tasn1_node_t *a, const tasn1_node_t *b) {
+    if (a == b)
+        return true;
+    tasn1_type_t ta = node_type(a);
+    tasn1_type_t tb = node_type(b);
+    if (ta == TASN1_OCTET_SEQUENCE_T && tb == TASN1_OCTET_SEQUENCE_T)
+        return compare_keys(a, b) == 0;
+    if (ta == TASN1_NUMBER_T || tb == TASN1_NUMBER_T)
+        return false;
+    if (ta == TASN1_FROZEN_T && tb == TASN1_FROZEN_T &&
+        ((const frozen_t *)a)->hash != ((const frozen_t *)b)->hash)
+        return false;
+    int na = tasn1_size(a);
+    int nb = tasn1_size(b);
+    if (na < 0 || na != nb)
+        return false;
+    TASN1_OCTET *pa = malloc(2 * na);
+    if (!pa)
+        return false;
+    TASN1_OCTET *pb = pa + na;
+    bool res = (tasn1_serialize(a, pa, na) == na) &&
+               (tasn1_serialize(b, pb, nb) == nb) &&
+               (memcmp(pa, pb, na) == 0);
+    free(pa);
+    return res;
+}
+
+/*
+ * Copy a node without its children.
+ */
+static tasn1_node_t *clone_shallow(const tasn1_node_t *node) {
+    if (!node)
+        return NULL;
+    if (is_tagged(node))
+        return (tasn1_node_t *)node;
+    switch (node->type) {
+        case TASN1_MAP_T:
+            return new_map(((const map_t *)node)->indexed);
+        case TASN1_ARRAY_T:
+            return tasn1_new_array();
+        case TASN1_OCTET_SEQUENCE_T: {
+            const octet_sequence_t *it = (const octet_sequence_t *)node;
+            return tasn1_new_octet_sequence(it->is_copy ? it->data : it->p_data,
+                                            it->size, it->is_copy);
+        }
+        case TASN1_NUMBER_ARRAY_T: {
+            const number_array_t *it = (const number_array_t *)node;
+            return tasn1_new_number_array(it->is_copy ? it->data : it->p_data,
+                                          it->count, it->is_copy);
+        }
+        case TASN1_FROZEN_T:
+            return tasn1_share(node);
+        default:
+            return NULL;
+    } // end switch //
+}
+
+struct clone_frame {
+    const tasn1_node_t *src;
+    tasn1_node_t *dst;
+    size_t index;
+};
+
+/*
+ * Containers are copied empty and added to their parent at once, then
+ * filled when their frame comes up, so any nesting depth is handled.
+ */
+tasn1_node_t *tasn1_clone(const tasn1_node_t *node) {
+    struct clone_frame local[TASN1_MAX_DEPTH];
+    struct clone_frame *stack = local;
+    size_t depth = TASN1_MAX_DEPTH;
+    size_t top = 0;
+
+    tasn1_node_t *res = clone_shallow(node);
+    if (!res || !is_container(node))
+        return res;
+    stack[top++] = (struct clone_frame){ node, res, 0 };
+    while (top > 0) {
+        struct clone_frame *frame = &stack[top - 1];
+        const tasn1_node_t *src;
+        tasn1_node_t *dst;
+        int erc;
+        if (frame->src->type == TASN1_ARRAY_T) {
+            const array_t *it = (const array_t *)frame->src;
+            if (frame->index == it->count) {
+                --top;
+                continue;
+            }
+            src = it->values[frame->index++];
+            dst = clone_shallow(src);
+            erc = dst ? tasn1_add_array_value(frame->dst, dst) : -ENOMEM;
+        } else {
+            const map_t *it = (const map_t *)frame->src;
+            if (frame->index == it->count) {
+                --top;
+                continue;
+            }
+            const item_t *item = &it->items[frame->index++];
+            tasn1_node_t *key = tasn1_clone(item->p_key);
+            src = item->p_val;
+            dst = clone_shallow(src);
+            erc = (key && dst) ? tasn1_add_map_item(frame->dst, key, dst) : -ENOMEM;
+            if (erc < 0)
+                tasn1_free(key);
+        }
+        if (erc < 0) {
+            tasn1_free(dst);
+            break;
+        }
+        if (is_container(src)) {
+            if (top == depth) {
+                struct clone_frame *grown = grow_stack(stack, local, &depth, sizeof(*stack));
+                if (!grown)
+                    break;
+                stack = grown;
+            }
+            stack[top++] = (struct clone_frame){ src, dst, 0 };
+        }
+    }
+    if (stack != local)
+        free(stack);
+    if (top > 0) {
+        tasn1_free(res);
+        return NULL;
+    }
+    return res;
+}
+
+/*
+ * Stable bottom up merge sort of map items by key, so that items with
+ * equal keys keep their order.
+ */
+static int sort_items(map_t *it) {
+    size_t count = it->count;
+    for (size_t i = 0; i < count; ++i) {
+        if (node_type(it->items[i].p_key) != TASN1_OCTET_SEQUENCE_T)
+            return -EINVAL;
+    }
+    size_t i = 1;
+    while (i < count && compare_keys(it->items[i - 1].p_key, it->items[i].p_key) <= 0)
+        ++i;
+    if (i >= count)
+        return 0; // Already sorted
+    item_t *src = it->items;
+    item_t *dst = malloc(count * sizeof(item_t));
+    if (!dst)
+        return -ENOMEM;
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t lo = 0; lo < count; lo += 2 * width) {
+            size_t mid = (lo + width < count) ? lo + width : count;
+            size_t hi = (mid + width < count) ? mid + width : count;
+            size_t a = lo, b = mid, k = lo;
+            while (a < mid && b < hi)
+                dst[k++] = (compare_keys(src[b].p_key, src[a].p_key) < 0) ? src[b++] : src[a++];
+            while (a < mid)
+                dst[k++] = src[a++];
+            while (b < hi)
+                dst[k++] = src[b++];
+        }
+        item_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != it->items) {
+        memcpy(it->items, src, count * sizeof(item_t));
+        free(src);
+    } else {
+        free(dst);
+    }
     return 0;
 }
 
-struct number {
-    tasn1_node_t node_base;
-    TASN1_NUMBER val;
+/*
+ * Sorts every map on a work list of containers, so any nesting depth is
+ * handled.
+ */
+int tasn1_canonicalize(tasn1_node_t *node) {
+    tasn1_node_t *local[TASN1_MAX_DEPTH];
+    tasn1_node_t **stack = local;
+    size_t depth = TASN1_MAX_DEPTH;
+    size_t top = 0;
+    int erc = 0;
+
+    if (!node)
+        return -ENOENT;
+    if (is_container(node))
+        stack[top++] = node;
+    while (erc == 0 && top > 0) {
+        node = stack[--top];
+        size_t count;
+        if (node->type == TASN1_MAP_T) {
+            map_t *it = (map_t *)node;
+            if (!it->indexed) {
+                erc = sort_items(it);
+                if (erc < 0)
+                    break;
+            }
+            count = it->count;
+        } else {
+            count = ((array_t *)node)->count;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            tasn1_node_t *child = (node->type == TASN1_MAP_T) ?
+                ((map_t *)node)->items[i].p_val : ((array_t *)node)->values[i];
+            if (!is_container(child))
+                continue;
+            if (top == depth) {
+                tasn1_node_t **grown = grow_stack(stack, local, &depth, sizeof(*stack));
+                if (!grown) {
+                    erc = -ENOMEM;
+                    break;
+                }
+                stack = grown;
+            }
+            stack[top++] = child;
+        }
+    }
+    if (stack != local)
+        free(stack);
+    return erc;
+}
+
+/*
+ * Path from the root of a diff to the current node. Every element is
+ * either a map key or an array index.
+ */
+struct path_elem {
+    const tasn1_node_t *key;
+    size_t index;
 };
-#define number_t struct number
 
-tasn1_node_t *tasn1_new_number(TASN1_NUMBER n) {
-    number_t *res = malloc(sizeof(number_t));
+/*
+ * Add val to array. val is released when it can't be added.
+ */
+static int append_value(tasn1_node_t *array, tasn1_node_t *val) {
+    if (!val)
+        return -ENOMEM;
+    int erc = tasn1_add_array_value(array, val);
+    if (erc < 0)
+        tasn1_free(val);
+    return erc;
+}
+
+static int add_delta_op(tasn1_node_t *delta, int op,
+                        const struct path_elem *path, size_t depth, const tasn1_node_t *val)
+{
+    tasn1_node_t *res = tasn1_new_array();
     if (!res)
-        return NULL;
-    res->node_base.type = TASN1_NUMBER_T;
-    INIT_LIST_HEAD(&res->node_base.list);
-    res->val = n;
-    return (tasn1_node_t *)res;
+        return -ENOMEM;
+    tasn1_node_t *elems = tasn1_new_array();
+    int erc = append_value(res, tasn1_new_number(op));
+    if (erc == 0)
+        erc = append_value(res, elems);
+    else
+        tasn1_free(elems);
+    for (size_t i = 0; erc == 0 && i < depth; ++i) {
+        erc = append_value(elems, path[i].key ?
+            tasn1_clone(path[i].key) : tasn1_new_number((TASN1_NUMBER)path[i].index));
+    }
+    if (erc == 0 && val)
+        erc = append_value(res, tasn1_clone(val));
+    if (erc < 0) {
+        tasn1_free(res);
+        return erc;
+    }
+    return append_value(delta, res);
 }
 
-static void number_free(number_t *it) {
-    free(it);
+/*
+ * Get the index of the first item with key, or the count of items if the
+ * key is not found.
+ */
+static size_t map_find(const map_t *it, const tasn1_node_t *key) {
+    size_t i = 0;
+    while (i < it->count && !nodes_equal(it->items[i].p_key, key))
+        ++i;
+    return i;
 }
 
-static int serialize_number(const number_t *number, TASN1_OCTET *po, size_t co) {
-    TASN1_NUMBER val = number->val;
-    if (val < 32) {
-        if (co < 1)
-            return -ENOMEM;
-        if (po)
-            *po = 0x00 | (TASN1_NUMBER_T << 5) | val;
-        return 1;
-    } else if (val < 256) {
-        if (co < 2)
-            return -ENOMEM;
-        if (po) {
-            *po++ = 0x80 | (TASN1_NUMBER_T << 5) | 0x01;
-            *po = val;
+struct key_ref {
+    const tasn1_node_t *key;
+    size_t index;
+};
+
+static int compare_key_refs(const void *a, const void *b) {
+    return compare_keys(((const struct key_ref *)a)->key, ((const struct key_ref *)b)->key);
+}
+
+/*
+ * Sort the keys of a map. Path elements tell keys from indexes by their
+ * type and select a single item, so keys have to be unique octet
+ * sequences. Returns -EINVAL otherwise.
+ */
+static int sort_keys(const map_t *it, struct key_ref *refs) {
+    for (size_t i = 0; i < it->count; ++i) {
+        if (node_type(it->items[i].p_key) != TASN1_OCTET_SEQUENCE_T)
+            return -EINVAL;
+        refs[i] = (struct key_ref){ it->items[i].p_key, i };
+    }
+    if (!it->indexed)
+        qsort(refs, it->count, sizeof(*refs), compare_key_refs);
+    for (size_t i = 1; i < it->count; ++i) {
+        if (compare_keys(refs[i - 1].key, refs[i].key) == 0)
+            return -EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * Match the items of two maps by merging their sorted keys. match[i]
+ * receives the index of the item of b with the key of item i of a or
+ * b->count, match[a->count + j] the index of the item of a with the key
+ * of item j of b or a->count.
+ */
+static int match_items(const map_t *a, const map_t *b, size_t *match) {
+    struct key_ref *ra = malloc((a->count + b->count + 1) * sizeof(*ra));
+    if (!ra)
+        return -ENOMEM;
+    struct key_ref *rb = ra + a->count;
+    size_t *match_b = match + a->count;
+    int erc = sort_keys(a, ra);
+    if (erc == 0)
+        erc = sort_keys(b, rb);
+    for (size_t i = 0; i < a->count; ++i)
+        match[i] = b->count;
+    for (size_t j = 0; j < b->count; ++j)
+        match_b[j] = a->count;
+    for (size_t i = 0, j = 0; erc == 0 && i < a->count && j < b->count; ) {
+        int cmp = compare_keys(ra[i].key, rb[j].key);
+        if (cmp == 0) {
+            match[ra[i].index] = rb[j].index;
+            match_b[rb[j].index] = ra[i].index;
         }
-        return 2;
-    } else {
-        if (co < 3)
+        if (cmp <= 0)
+            ++i;
+        if (cmp >= 0)
+            ++j;
+    }
+    free(ra);
+    return erc;
+}
+
+/*
+ * tasn1_patch() appends added items to maps without index. Check that the
+ * items of b are then in the same order.
+ */
+static bool keeps_order(const map_t *a, const map_t *b, const size_t *match_b) {
+    if (b->indexed)
+        return true;
+    size_t next = 0;
+    for (size_t j = 0; j < b->count; ++j) {
+        if (match_b[j] == a->count)
+            next = a->count;
+        else if (match_b[j] < next)
+            return false;
+        else
+            next = match_b[j] + 1;
+    }
+    return true;
+}
+
+static int diff_node(const tasn1_node_t *a, const tasn1_node_t *b, tasn1_node_t *delta,
+                     struct path_elem *path, size_t depth)
+{
+    tasn1_type_t ta = node_type(a);
+    tasn1_type_t tb = node_type(b);
+    int erc;
+
+    if (ta == TASN1_MAP_T && tb == TASN1_MAP_T) {
+        if (depth == TASN1_MAX_DEPTH)
+            return -ELOOP;
+        const map_t *ma = (const map_t *)a;
+        const map_t *mb = (const map_t *)b;
+        if (ma->indexed != mb->indexed)
+            return add_delta_op(delta, TASN1_DELTA_SET, path, depth, b);
+        size_t *match = malloc((ma->count + mb->count + 1) * sizeof(*match));
+        if (!match)
             return -ENOMEM;
-        if (po) {
-            *po++ = 0x80 | (TASN1_NUMBER_T << 5) | 0x02;
-            *po++ = val / 256;
-            *po = val & 0xff;
+        const size_t *match_b = match + ma->count;
+        erc = match_items(ma, mb, match);
+        if (erc == 0 && !keeps_order(ma, mb, match_b)) {
+            free(match);
+            return add_delta_op(delta, TASN1_DELTA_SET, path, depth, b);
         }
-        return 3;
+        for (size_t i = 0; erc >= 0 && i < ma->count; ++i) {
+            size_t j = match[i];
+            path[depth].key = ma->items[i].p_key;
+            if (j < mb->count)
+                erc = diff_node(ma->items[i].p_val, mb->items[j].p_val, delta, path, depth + 1);
+            else
+                erc = add_delta_op(delta, TASN1_DELTA_REMOVE, path, depth + 1, NULL);
+        }
+        for (size_t j = 0; erc >= 0 && j < mb->count; ++j) {
+            if (match_b[j] < ma->count)
+                continue;
+            path[depth].key = mb->items[j].p_key;
+            erc = add_delta_op(delta, TASN1_DELTA_SET, path, depth + 1, mb->items[j].p_val);
+        }
+        free(match);
+        return (erc < 0) ? erc : 0;
+    }
+    if (ta == TASN1_ARRAY_T && tb == TASN1_ARRAY_T) {
+        if (depth == TASN1_MAX_DEPTH)
+            return -ELOOP;
+        const array_t *aa = (const array_t *)a;
+        const array_t *ab = (const array_t *)b;
+        size_t i = 0;
+        path[depth].key = NULL;
+        for (; i < aa->count && i < ab->count; ++i) {
+            path[depth].index = i;
+            erc = diff_node(aa->values[i], ab->values[i], delta, path, depth + 1);
+            if (erc < 0)
+                return erc;
+        }
+        // Appended values:
+        for (; i < ab->count; ++i) {
+            path[depth].index = i;
+            erc = add_delta_op(delta, TASN1_DELTA_SET, path, depth + 1, ab->values[i]);
+            if (erc < 0)
+                return erc;
+        }
+        // Removed values, last first to keep the indexes valid:
+        for (size_t n = aa->count; n > i; ) {
+            path[depth].index = --n;
+            erc = add_delta_op(delta, TASN1_DELTA_REMOVE, path, depth + 1, NULL);
+            if (erc < 0)
+                return erc;
+        }
+        return 0;
     }
+    if (nodes_equal(a, b))
+        return 0;
+    return add_delta_op(delta, TASN1_DELTA_SET, path, depth, b);
 }
 
-int tasn1_serialize(const tasn1_node_t *node, TASN1_OCTET *po, size_t co) {
-    if (!node)
+int tasn1_diff(const tasn1_node_t *base, const tasn1_node_t *next, tasn1_node_t **delta) {
+    struct path_elem path[TASN1_MAX_DEPTH] = { { NULL, 0 } };
+    if (!base || !next || !delta)
         return -ENOENT;
-    switch (node->type) {
-        case TASN1_MAP_T:
-            return serialize_map((map_t *)node, po, co);
-        case TASN1_ARRAY_T: 
-            return serialize_array((array_t *)node, po, co);
-        case TASN1_OCTET_SEQUENCE_T: 
-            return serialize_octet_sequence((octet_sequence_t *)node, po, co);
-        case TASN1_NUMBER_T: 
-            return serialize_number((number_t *)node, po, co);
-        default:
+    *delta = tasn1_new_array();
+    if (!*delta)
+        return -ENOMEM;
+    int erc = diff_node(base, next, *delta, path, 0);
+    if (erc < 0) {
+        tasn1_free(*delta);
+        *delta = NULL;
+    }
+    return erc;
+}
+
+static tasn1_node_t *array_at(const tasn1_node_t *node, size_t index) {
+    const array_t *it = (const array_t *)node;
+    return (index < it->count) ? it->values[index] : NULL;
+}
+
+/*
+ * Take the value out of an operation, so that it survives the release
+ * of the delta.
+ */
+static tasn1_node_t *take_value(tasn1_node_t *op) {
+    array_t *it = (array_t *)op;
+    tasn1_node_t *res = it->values[2];
+    it->values[2] = NULL;
+    return res;
+}
+
+/*
+ * Get the slot of the value selected by a path element, or NULL.
+ */
+static tasn1_node_t **child_at(tasn1_node_t *container, const tasn1_node_t *elem) {
+    if (node_type(elem) == TASN1_NUMBER_T) {
+        if (node_type(container) != TASN1_ARRAY_T)
+            return NULL;
+        array_t *it = (array_t *)container;
+        size_t index = (uint16_t)get_number(elem);
+        return (index < it->count) ? &it->values[index] : NULL;
+    }
+    if (node_type(container) != TASN1_MAP_T)
+        return NULL;
+    map_t *it = (map_t *)container;
+    size_t index = map_find(it, elem);
+    return (index < it->count) ? &it->items[index].p_val : NULL;
+}
+
+static int apply_op(tasn1_node_t **root, tasn1_node_t *op) {
+    const tasn1_node_t *code = array_at(op, 0);
+    const tasn1_node_t *elems = array_at(op, 1);
+    const tasn1_node_t *val = array_at(op, 2);
+    if (!code || node_type(code) != TASN1_NUMBER_T || !elems || node_type(elems) != TASN1_ARRAY_T)
+        return -EINVAL;
+    int opcode = get_number(code);
+    if (opcode != TASN1_DELTA_SET && opcode != TASN1_DELTA_REMOVE)
+        return -EINVAL;
+    if ((opcode == TASN1_DELTA_SET) != (val != NULL))
+        return -EINVAL;
+
+    const array_t *path = (const array_t *)elems;
+    if (path->count == 0) {
+        if (opcode != TASN1_DELTA_SET)
             return -EINVAL;
-    } // end switch //
+        tasn1_free(*root);
+        *root = take_value(op);
+        return 0;
+    }
+    tasn1_node_t **slot = root;
+    for (size_t i = 0; i + 1 < path->count; ++i) {
+        slot = child_at(*slot, path->values[i]);
+        if (!slot)
+            return -EINVAL;
+    }
+    tasn1_node_t *container = *slot;
+    const tasn1_node_t *elem = path->values[path->count - 1];
+
+    if (node_type(elem) == TASN1_NUMBER_T) {
+        if (node_type(container) != TASN1_ARRAY_T)
+            return -EINVAL;
+        array_t *it = (array_t *)container;
+        size_t index = (uint16_t)get_number(elem);
+        if (opcode == TASN1_DELTA_SET) {
+            if (index == it->count)
+                return tasn1_add_array_value(container, take_value(op));
+            if (index > it->count)
+                return -EINVAL;
+            tasn1_free(it->values[index]);
+            it->values[index] = take_value(op);
+            return 0;
+        }
+        if (index >= it->count)
+            return -EINVAL;
+        tasn1_free(it->values[index]);
+        memmove(&it->values[index], &it->values[index + 1],
+                (it->count - index - 1) * sizeof(tasn1_node_t *));
+        --it->count;
+        return 0;
+    }
+
+    if (node_type(container) != TASN1_MAP_T)
+        return -EINVAL;
+    map_t *it = (map_t *)container;
+    size_t index = map_find(it, elem);
+    if (opcode == TASN1_DELTA_SET) {
+        if (index < it->count) {
+            tasn1_free(it->items[index].p_val);
+            it->items[index].p_val = take_value(op);
+            return 0;
+        }
+        tasn1_node_t *key = tasn1_clone(elem);
+        if (!key)
+            return -ENOMEM;
+        int erc = tasn1_add_map_item(container, key, array_at(op, 2));
+        if (erc < 0) {
+            tasn1_free(key);
+            return erc;
+        }
+        take_value(op);
+        return 0;
+    }
+    if (index >= it->count)
+        return -EINVAL;
+    tasn1_free(it->items[index].p_key);
+    tasn1_free(it->items[index].p_val);
+    memmove(&it->items[index], &it->items[index + 1], (it->count - index - 1) * sizeof(item_t));
+    --it->count;
+    return 0;
 }
 
-int tasn1_size(const tasn1_node_t *node) {
-    return tasn1_serialize(node, NULL, 65536);
+int tasn1_patch(tasn1_node_t **base, tasn1_node_t *delta) {
+    int erc = 0;
+    if (!base || !*base || !delta) {
+        tasn1_free(delta);
+        return -ENOENT;
+    }
+    if (node_type(delta) != TASN1_ARRAY_T) {
+        tasn1_free(delta);
+        return -EINVAL;
+    }
+    const array_t *it = (const array_t *)delta;
+    for (size_t i = 0; i < it->count; ++i) {
+        tasn1_node_t *op = it->values[i];
+        if (node_type(op) != TASN1_ARRAY_T) {
+            erc = -EINVAL;
+            break;
+        }
+        erc = apply_op(base, op);
+        if (erc < 0)
+            break;
+    }
+    tasn1_free(delta);
+    return erc;
 }
 
-void tasn1_free(tasn1_node_t *node) {
-    if (node) {
-        switch (node->type) {
+static TASN1_NUMBER parse_number(const TASN1_OCTET *po, int n) {
+    if (n == 1)
+        return po[0] & 0x1f;
+    if (n == 2)
+        return po[1];
+    return (TASN1_NUMBER)(uint16_t)(po[1] << 8 | po[2]);
+}
+
+/*
+ * Size of the index item at the start of a map's content, 0 for maps
+ * without index.
+ */
+static int index_size(const TASN1_OCTET *content, size_t size) {
+    const TASN1_OCTET *table;
+    size_t count;
+    if (size == 0 || content[0] != (TASN1_OCTET_SEQUENCE_T << 5))
+        return 0;
+    int n = parse_octets(content + 1, size - 1, &table, &count);
+    return (n < 0) ? n : 1 + n;
+}
+
+struct decode_frame {
+    tasn1_node_t *dst;
+    const TASN1_OCTET *end;
+    tasn1_node_t *key; // Map key waiting for its value
+};
+
+/*
+ * Containers are created empty and added to their parent at once, then
+ * filled from the octets up to the end of their frame, like in
+ * tasn1_clone().
+ */
+int tasn1_decode(const TASN1_OCTET *po, size_t co, tasn1_node_t **node) {
+    struct decode_frame local[TASN1_MAX_DEPTH];
+    struct decode_frame *stack = local;
+    size_t depth = TASN1_MAX_DEPTH;
+    size_t top = 0;
+    const TASN1_OCTET *p = po;
+    tasn1_node_t *res = NULL;
+    int erc = 0;
+
+    if (!po || !node)
+        return -EINVAL;
+    do {
+        struct decode_frame *frame = (top > 0) ? &stack[top - 1] : NULL;
+        const TASN1_OCTET *end = frame ? frame->end : po + co;
+        tasn1_type_t type;
+        size_t size;
+        tasn1_node_t *val;
+        int skip = 0;
+        int n = parse_header(p, end - p, &type, &size);
+        if (n <= 0 || (size_t)(end - p) < n + size) {
+            erc = -EINVAL;
+            break;
+        }
+        switch (type) {
             case TASN1_MAP_T:
-                map_free((map_t *)node);
-                return;
-            case TASN1_ARRAY_T: 
-                array_free((array_t *)node);
-                return;
-            case TASN1_OCTET_SEQUENCE_T: 
-                octet_sequence_free((octet_sequence_t *)node);
-                return;
-            case TASN1_NUMBER_T: 
-                number_free((number_t *)node);
-                return;
+                skip = index_size(p + n, size);
+                val = (skip >= 0) ? new_map(skip > 0) : NULL;
+                break;
+            case TASN1_ARRAY_T:
+                val = tasn1_new_array();
+                break;
+            case TASN1_OCTET_SEQUENCE_T:
+                val = tasn1_new_octet_sequence(p + n, size, true);
+                break;
             default:
-                return;
+                val = tasn1_new_number(parse_number(p, n));
+                break;
         } // end switch //
+        if (!val) {
+            erc = (skip < 0) ? skip : -ENOMEM;
+            break;
+        }
+        if (!frame) {
+            res = val;
+        } else if (frame->dst->type == TASN1_ARRAY_T) {
+            erc = tasn1_add_array_value(frame->dst, val);
+        } else if (!frame->key) {
+            if (type == TASN1_OCTET_SEQUENCE_T)
+                frame->key = val;
+            else
+                erc = -EINVAL;
+        } else {
+            erc = tasn1_add_map_item(frame->dst, frame->key, val);
+            if (erc >= 0)
+                frame->key = NULL;
+        }
+        if (erc < 0) {
+            tasn1_free(val);
+            break;
+        }
+        if (type == TASN1_MAP_T || type == TASN1_ARRAY_T) {
+            if (top == depth) {
+                struct decode_frame *grown = grow_stack(stack, local, &depth, sizeof(*stack));
+                if (!grown) {
+                    erc = -ENOMEM;
+                    break;
+                }
+                stack = grown;
+            }
+            stack[top++] = (struct decode_frame){ val, p + n + size, NULL };
+            p += n + skip;
+        } else {
+            p += n + size;
+        }
+        while (top > 0 && p == stack[top - 1].end) {
+            if (stack[top - 1].key) {
+                erc = -EINVAL;
+                break;
+            }
+            --top;
+        }
+    } while (erc == 0 && top > 0);
+
+    if (erc < 0) {
+        while (top > 0)
+            tasn1_free(stack[--top].key);
+        tasn1_free(res);
+    }
+    if (stack != local)
+        free(stack);
+    if (erc < 0)
+        return erc;
+    *node = res;
+    return p - po;
+}
+
+int tasn1_patch_encoded(tasn1_node_t **base, const TASN1_OCTET *po, size_t co) {
+    tasn1_node_t *delta;
+    if (!base || !*base)
+        return -ENOENT;
+    int n = tasn1_decode(po, co, &delta);
+    if (n < 0)
+        return n;
+    if ((size_t)n != co) {
+        tasn1_free(delta);
+        return -EINVAL;
     }
+    return tasn1_patch(base, delta);
 }
@@ -0,0 +1,140 @@
+#ifndef TASN1_CT_HPP
+#define TASN1_CT_HPP
+
+#include "tasn1.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Encoding of constant values at compile time.
+ *
+ * The functions produce the same octets as building the value from nodes
+ * and calling tasn1_serialize(), e.g.
+ *
+ *     constexpr auto hello{ct::map(ct::item("KEY1", "VAL1"),
+ *                                  ct::item("KEY2", ct::boolean<true>()))};
+ *
+ * Strings include their terminating NUL, like tasn1_new_string().
+ */
+namespace tasn1 {
+namespace ct {
+
+template <size_t N>
+using octets_t = std::array<uint8_t, N>;
+
+namespace detail {
+
+// See serialize_header() in tasn1.c:
+constexpr size_t header_size(size_t size) {
+    return (size < 32) ? 1 : (size < 256) ? 2 : 3;
+}
+
+template <size_t S>
+constexpr octets_t<header_size(S)> header(tasn1_type_t type) {
+    static_assert(S < 65536, "Content exceeds 65535 octets");
+    octets_t<header_size(S)> res{};
+    if constexpr (S < 32) {
+        res[0] = 0x00 | (type << 5) | S;
+    } else if constexpr (S < 256) {
+        res[0] = 0x80 | (type << 5) | 0x01;
+        res[1] = S;
+    } else {
+        res[0] = 0x80 | (type << 5) | 0x02;
+        res[1] = S / 256;
+        res[2] = S & 0xff;
+    }
+    return res;
+}
+
+// See serialize_number() in tasn1.c, negative numbers take two octets:
+constexpr size_t number_size(TASN1_NUMBER n) {
+    return (static_cast<uint16_t>(n) < 32) ? 1 : (static_cast<uint16_t>(n) < 256) ? 2 : 3;
+}
+
+template <size_t A>
+constexpr octets_t<A> concat(const octets_t<A> &a) {
+    return a;
+}
+
+template <size_t A, size_t B>
+constexpr octets_t<A + B> concat(const octets_t<A> &a, const octets_t<B> &b) {
+    octets_t<A + B> res{};
+    for (size_t i = 0; i < A; ++i)
+        res[i] = a[i];
+    for (size_t i = 0; i < B; ++i)
+        res[A + i] = b[i];
+    return res;
+}
+
+template <size_t A, size_t B, size_t C, size_t... R>
+constexpr auto concat(const octets_t<A> &a, const octets_t<B> &b,
+                      const octets_t<C> &c, const octets_t<R> &...rest) {
+    return concat(concat(a, b), c, rest...);
+}
+
+} // end namespace detail //
+
+/**
+ * @brief Encoded map item, see item().
+ */
+template <size_t N>
+struct Item {
+    octets_t<N> octets;
+};
+
+template <TASN1_NUMBER V>
+constexpr octets_t<detail::number_size(V)> number() {
+    constexpr uint16_t val{static_cast<uint16_t>(V)};
+    octets_t<detail::number_size(V)> res{};
+    if constexpr (val < 32) {
+        res[0] = 0x00 | (TASN1_NUMBER_T << 5) | val;
+    } else if constexpr (val < 256) {
+        res[0] = 0x80 | (TASN1_NUMBER_T << 5) | 0x01;
+        res[1] = val;
+    } else {
+        res[0] = 0x80 | (TASN1_NUMBER_T << 5) | 0x02;
+        res[1] = val >> 8;
+        res[2] = val & 0xff;
+    }
+    return res;
+}
+
+template <bool B>
+constexpr auto boolean() {
+    return number<B ? 1 : 0>();
+}
+
+template <size_t N>
+constexpr octets_t<detail::header_size(N) + N> string(const char (&s)[N]) {
+    octets_t<N> content{};
+    for (size_t i = 0; i < N; ++i)
+        content[i] = static_cast<uint8_t>(s[i]);
+    return detail::concat(detail::header<N>(TASN1_OCTET_SEQUENCE_T), content);
+}
+
+template <size_t K, size_t V>
+constexpr Item<detail::header_size(K) + K + V> item(const char (&key)[K], const octets_t<V> &val) {
+    return {detail::concat(string(key), val)};
+}
+
+template <size_t K, size_t V>
+constexpr auto item(const char (&key)[K], const char (&val)[V]) {
+    return item(key, string(val));
+}
+
+template <size_t... N>
+constexpr auto map(const Item<N> &...items) {
+    return detail::concat(detail::header<(0 + ... + N)>(TASN1_MAP_T), items.octets...);
+}
+
+template <size_t... N>
+constexpr auto array(const octets_t<N> &...values) {
+    return detail::concat(detail::header<(0 + ... + N)>(TASN1_ARRAY_T), values...);
+}
+
+} // end namespace ct //
+} // end namespace tasn1 //
+
+#endif // TASN1_CT_HPP
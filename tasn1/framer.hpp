@@ -0,0 +1,53 @@
+#ifndef TASN1_FRAMER_HPP
+#define TASN1_FRAMER_HPP
+
+#include "node.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tasn1 {
+
+struct Frame {
+    const uint8_t *data;
+    size_t size;
+};
+
+typedef std::vector<Frame> batch_t;
+
+/**
+ * @brief Splits a stream of top level values into complete messages.
+ *
+ * Messages that are fully contained in the fed octets are referenced in
+ * place, only an incomplete message at the end is copied and kept for the
+ * next feed. The frames of a batch stay valid until the next call of
+ * feed() or until the fed octets are released, whatever comes first.
+ *
+ * A checksummed framer expects every value to be followed by its CRC32C,
+ * see Node::serializeFramed(). The checksum is verified and the frames
+ * reference the value only. Frames with a wrong checksum are skipped and
+ * counted by corrupted(), the following frames are received as usual.
+ */
+class Framer
+{
+public:
+    explicit Framer(bool _checksummed = false): checksummed{_checksummed} {}
+
+    size_t feed(const uint8_t *po, size_t co, batch_t &batch);
+
+    size_t pending() const { return partial.size(); }
+    size_t corrupted() const { return dropped; }
+
+private:
+    size_t peek(const uint8_t *po, size_t co) const;
+    bool verify(const uint8_t *po, size_t co, batch_t &batch);
+
+    bool checksummed;
+    size_t dropped{0};
+    vector_t partial;
+    vector_t completed;
+};
+
+} // end namespace tasn1 //
+
+#endif // TASN1_FRAMER_HPP
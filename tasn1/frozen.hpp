@@ -0,0 +1,24 @@
+#ifndef TASN1_FROZEN_HPP
+#define TASN1_FROZEN_HPP
+
+#include "node.hpp"
+
+namespace tasn1 {
+
+class Frozen: public Node
+{
+public:
+    // Consumes node, which must not be used afterwards.
+    explicit Frozen(Node &node);
+
+    Frozen share() const;
+
+protected:
+    Frozen(struct tasn1_node *_node): Node(_node) {}
+
+    static struct tasn1_node *freeze(Node &node);
+};
+
+} // end namespace tasn1 //
+
+#endif // TASN1_FROZEN_HPP
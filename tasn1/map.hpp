@@ -10,7 +10,7 @@ namespace tasn1 {
 class Map: public Node
 {
 public:
-    Map();
+    explicit Map(bool indexed = false);
 
     void add(Node &key, Node &val);
     void add(const std::string &key, Node &val);
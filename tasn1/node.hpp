@@ -3,6 +3,7 @@
 
 #include <jsonx.hpp>
 
+#include <cstdint>
 #include <memory>
 #include <stdexcept>
 #include <vector>
@@ -18,6 +19,11 @@ typedef std::vector<unsigned char> vector_t;
 class Node {
 public:
     static Node fromJson(const jsonx::json &j);
+    // Large arrays and objects are converted by up to threads threads,
+    // 0 selects the number of cores. The result equals fromJson(j).
+    static Node fromJson(const jsonx::json &j, unsigned threads);
+    static Node diff(const Node &base, const Node &next);
+    static Node decode(const vector_t &buffer);
 
     Node() = delete;
     Node(const Node &other) = delete;
@@ -32,12 +38,33 @@ public:
     }
 
     struct tasn1_node *getNode() { return node; }
+    const struct tasn1_node *getNode() const { return node; }
 
+    Node clone() const;
+    void patch(Node &delta);
+    void patch(const vector_t &delta);
+    // Sorts the map items in place, see tasn1_canonicalize().
+    void canonicalize();
+    // Only frozen nodes keep their hash, others are encoded on every call.
+    uint64_t hash() const;
     void serialize(vector_t &buffer);
+    void serialize(vector_t &buffer, uint64_t &hash);
+    void serializeFramed(vector_t &buffer);
 
 protected:
+    friend class Frozen;
+
     Node(struct tasn1_node *_node): node{_node} {}
 
+    // Hand the node over to a function that consumes it, later use of this
+    // object throws.
+    struct tasn1_node *release() {
+        setContained();
+        struct tasn1_node *res{node};
+        node = nullptr;
+        return res;
+    }
+
     struct tasn1_node *node;
     bool contained{false};
 };
@@ -0,0 +1,22 @@
+#ifndef TASN1_NUMBERARRAY_HPP
+#define TASN1_NUMBERARRAY_HPP
+
+#include "node.hpp"
+
+#include <vector>
+
+namespace tasn1 {
+
+class NumberArray: public Node
+{
+public:
+    NumberArray(const int16_t *pn, size_t cn);
+    NumberArray(const std::vector<int16_t> &v);
+
+    const int16_t *data() const;
+    size_t size() const;
+};
+
+} // end namespace tasn1 //
+
+#endif // TASN1_NUMBERARRAY_HPP
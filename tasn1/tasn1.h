@@ -12,6 +12,16 @@ extern "C" {
 #define TASN1_OCTET  uint8_t
 #define TASN1_NUMBER int16_t
 
+/**
+ * @brief Nesting depth of maps and arrays that tasn1_size(),
+ *        tasn1_serialize() and tasn1_clone() handle with a traversal stack
+ *        on the call stack. Deeper nodes are handled with a stack on the
+ *        heap. tasn1_diff() rejects deeper nodes.
+ */
+#ifndef TASN1_MAX_DEPTH
+#define TASN1_MAX_DEPTH 32
+#endif
+
 /**
  * @brief Internal node structure that holds a value.
  */
@@ -21,9 +31,17 @@ struct tasn1_node;
 /**
  * @brief Datatype of a asn1_node.
  */
-enum tasn1_type { TASN1_MAP_T = 0, TASN1_ARRAY_T = 1, TASN1_OCTET_SEQUENCE_T = 2, TASN1_NUMBER_T = 3 };
+enum tasn1_type { TASN1_MAP_T = 0, TASN1_ARRAY_T = 1, TASN1_OCTET_SEQUENCE_T = 2, TASN1_NUMBER_T = 3,
+                  TASN1_FROZEN_T = 4 /* Pre-encoded node, see tasn1_freeze() */,
+                  TASN1_NUMBER_ARRAY_T = 5 /* Packed array of numbers, see tasn1_new_number_array() */ };
 #define tasn1_type_t enum tasn1_type
 
+/**
+ * @brief Operation codes of a delta, see tasn1_diff().
+ */
+enum tasn1_delta_op { TASN1_DELTA_SET = 0, TASN1_DELTA_REMOVE = 1 };
+#define tasn1_delta_op_t enum tasn1_delta_op
+
 /**
  * @brief Create new asn1_node for octet sequence.
  * 
@@ -71,15 +89,47 @@ tasn1_node_t *tasn1_new_map();
  * @brief Add item to a map
  * 
  * @param map The map to add this item to.
- * @param key Item key 
+ * @param key Item key, must not be an empty octet sequence.
  * @param val Item value
- * @return int Error code. 0 is OK
+ * @return int Error code. 0 is OK, -EINVAL for an empty key. On error the
+ *         key and the value are still owned by the caller.
  */
 int tasn1_add_map_item(tasn1_node_t *map, tasn1_node_t *key, tasn1_node_t *val);
 
 #define tasn1_add_map_string(MAP, KEY, COPY, VAL) \
     tasn1_add_map_item(MAP, tasn1_new_octet_sequence((const TASN1_OCTET *)KEY, strlen(KEY) + 1 , COPY), VAL)
 
+/**
+ * @brief Create new asn1_node for storing of map items with an index.
+ * 
+ * The items are kept sorted by the octets of their keys, which have to be
+ * octet sequences. The encoded map starts with an item with empty key and
+ * a table of item offsets as value, see doc/spec.md. tasn1_map_lookup()
+ * uses it for a binary search.
+ * 
+ * @return tasn1_node_t* New asn1_node
+ */
+tasn1_node_t *tasn1_new_indexed_map();
+
+/**
+ * @brief Find the value of a key in an encoded map.
+ * 
+ * Indexed maps are searched binary, other maps item by item.
+ * 
+ * @param po Pointer to the encoded map.
+ * @param co Size of the encoded map.
+ * @param pk Pointer to the octets of the key.
+ * @param ck Number of octets of the key.
+ * @param val Receives a pointer to the encoded value.
+ * @return int Size of the encoded value, -ENOENT if the key is not found
+ *         or other negative error code.
+ */
+int tasn1_map_lookup(const TASN1_OCTET *po, size_t co,
+                     const TASN1_OCTET *pk, size_t ck, const TASN1_OCTET **val);
+
+#define tasn1_map_lookup_string(PO, CO, KEY, VAL) \
+    tasn1_map_lookup(PO, CO, (const TASN1_OCTET *)KEY, strlen(KEY) + 1, VAL)
+
 /**
  * @brief Create new asn1_node for number.
  * 
@@ -97,6 +147,54 @@ tasn1_node_t *tasn1_new_number(TASN1_NUMBER n);
 #define tasn1_new_bool(F) \
     tasn1_new_number((F) ? 1 : 0)
 
+/**
+ * @brief Create new asn1_node for a packed array of numbers.
+ * 
+ * The numbers are kept in one block in host order and are encoded like an
+ * array of number nodes, without one node per element.
+ * 
+ * @param pn Pointer to the numbers.
+ * @param cn Count of numbers.
+ * @param copy When true, the values are copied, otherwise only reference
+ * @return tasn1_node_t* New asn1_node
+ */
+tasn1_node_t *tasn1_new_number_array(const TASN1_NUMBER *pn, size_t cn, bool copy);
+
+/**
+ * @brief Get the numbers of a packed array of numbers.
+ * 
+ * @param node Node created by tasn1_new_number_array().
+ * @param cn Receives the count of numbers, may be NULL.
+ * @return const TASN1_NUMBER* Pointer to the numbers or NULL if the node
+ *         is no packed array of numbers.
+ */
+const TASN1_NUMBER *tasn1_number_array_data(const tasn1_node_t *node, size_t *cn);
+
+/**
+ * @brief Freeze a node into its encoded form.
+ *
+ * The node is serialized once and then released. The returned node emits
+ * the stored octets on every serialization and can be attached to many
+ * parents by means of tasn1_share(). On failure NULL is returned and the
+ * original node is left untouched.
+ *
+ * @param node Node to freeze.
+ * @return tasn1_node_t* New frozen node or NULL.
+ */
+tasn1_node_t *tasn1_freeze(tasn1_node_t *node);
+
+/**
+ * @brief Get an additional reference to a frozen node.
+ *
+ * The encoded octets are shared with reference counting, every reference
+ * can be added to a different parent and has to be released separately.
+ * Reference counting is not thread safe.
+ *
+ * @param frozen Frozen node to share.
+ * @return tasn1_node_t* New reference to the frozen node or NULL.
+ */
+tasn1_node_t *tasn1_share(const tasn1_node_t *frozen);
+
 /**
  * @brief Get number of octets required for serialization of this node.
  * 
@@ -115,8 +213,196 @@ int tasn1_size(const tasn1_node_t *node);
  */
 int tasn1_serialize(const tasn1_node_t *node, TASN1_OCTET *po, size_t co);
 
+/**
+ * @brief Serialize node to a buffer and compute a 64 bit FNV-1a hash of the
+ *        written octets in the same pass.
+ *
+ * @param node Node to serialize.
+ * @param po Pointer to buffer for serialization.
+ * @param co Size of buffer for serialization.
+ * @param hash Receives the hash of the written octets.
+ * @return int Number of octets written or negative error number.
+ */
+int tasn1_serialize_hash(const tasn1_node_t *node, TASN1_OCTET *po, size_t co, uint64_t *hash);
+
+/**
+ * @brief Get the 64 bit FNV-1a hash of the encoding of a node.
+ *
+ * Frozen nodes keep the hash computed by tasn1_freeze(), so equal frozen
+ * subtrees are found without encoding them again. No other node stores a
+ * hash of its subtree: they are encoded into a temporary buffer on every
+ * call.
+ *
+ * @param node The node to hash.
+ * @param hash Receives the hash.
+ * @return int Error code. 0 is OK
+ */
+int tasn1_hash(const tasn1_node_t *node, uint64_t *hash);
+
+/**
+ * @brief Number of octets of the checksum behind a framed value.
+ */
+#define TASN1_CRC_SIZE 4
+
+/**
+ * @brief Serialize node to a buffer, followed by the CRC32C of the written
+ *        octets (MSB...LSB), computed in the same pass.
+ *
+ * Uses the CRC32 instructions of SSE4.2 or ARMv8 when available.
+ *
+ * @param node Node to serialize.
+ * @param po Pointer to buffer for serialization.
+ * @param co Size of buffer, at least tasn1_size() + TASN1_CRC_SIZE.
+ * @return int Number of octets written incl. checksum or negative error number.
+ */
+int tasn1_serialize_framed(const tasn1_node_t *node, TASN1_OCTET *po, size_t co);
+
+/**
+ * @brief Verify a value written by tasn1_serialize_framed().
+ *
+ * @param po Pointer to the framed value.
+ * @param co Number of octets available.
+ * @param val Receives a pointer to the encoded value when it is valid.
+ * @return int Size of the encoded value without checksum, 0 when co is too
+ *         short for the complete frame, -EBADMSG when the checksum does not
+ *         match or other negative error code. The frame occupies the
+ *         returned size + TASN1_CRC_SIZE octets.
+ */
+int tasn1_verify_framed(const TASN1_OCTET *po, size_t co, const TASN1_OCTET **val);
+
+/**
+ * @brief Bring a node into canonical form.
+ *
+ * The node is modified in place, the previous order of the map items is
+ * lost; canonicalize a copy made by tasn1_clone() to keep it. The items of
+ * all maps are sorted by the octets of their keys, like in
+ * indexed maps; items with equal keys keep their order. Headers and numbers
+ * are always encoded in their shortest form, so equal content results in
+ * equal octets. Frozen nodes are kept as they are, canonicalize before
+ * freezing.
+ *
+ * @param node The node to canonicalize.
+ * @return int Error code. 0 is OK, -EINVAL when a key is no octet sequence.
+ */
+int tasn1_canonicalize(tasn1_node_t *node);
+
+/**
+ * @brief Get number of octets required for a traversal stack.
+ * 
+ * tasn1_serialize_ex() keeps the content size of every map and array on
+ * the stack in addition to one frame per level of nesting, so that it
+ * needs no further memory. tasn1_size_ex() needs the frames only.
+ * 
+ * @param depth Maximum nesting depth of maps and arrays.
+ * @param containers Number of maps and arrays, 0 for tasn1_size_ex().
+ * @return size_t Number of octets for tasn1_size_ex() or tasn1_serialize_ex().
+ */
+size_t tasn1_stack_size(size_t depth, size_t containers);
+
+/**
+ * @brief Get number of octets required for serialization of this node,
+ *        using a caller supplied traversal stack.
+ * 
+ * @param node The node to query.
+ * @param stack Traversal stack, aligned like memory returned by malloc.
+ * @param stack_size Size of the stack, see tasn1_stack_size().
+ * @return int Number of octets or negative error code. -ELOOP when the
+ *         node is nested deeper than the stack allows.
+ */
+int tasn1_size_ex(const tasn1_node_t *node, void *stack, size_t stack_size);
+
+/**
+ * @brief Serialize node to a buffer, using a caller supplied traversal stack.
+ * 
+ * @param node Node to serialize.
+ * @param po Pointer to buffer for serialization.
+ * @param co Size of buffer for serialization.
+ * @param stack Traversal stack, aligned like memory returned by malloc.
+ * @param stack_size Size of the stack, see tasn1_stack_size().
+ * @return int Number of octets written or negative error number. -ELOOP
+ *         when the node is nested too deep or has too many maps and arrays
+ *         for the stack. No memory is allocated.
+ */
+int tasn1_serialize_ex(const tasn1_node_t *node, TASN1_OCTET *po, size_t co,
+                       void *stack, size_t stack_size);
+
+/**
+ * @brief Get the size of the encoded value at the start of a buffer.
+ *        Only the header and the length octets are inspected.
+ * 
+ * @param po Pointer to the encoded octets.
+ * @param co Number of octets available.
+ * @return int Number of octets of the complete value, 0 when co is too
+ *         short to hold the header or negative error code.
+ */
+int tasn1_peek_size(const TASN1_OCTET *po, size_t co);
+
+/**
+ * @brief Create a deep copy of a node. Octet sequences that only reference
+ *        their value keep referencing it, frozen nodes are shared.
+ * 
+ * @param node The node to copy.
+ * @return tasn1_node_t* New asn1_node or NULL.
+ */
+tasn1_node_t *tasn1_clone(const tasn1_node_t *node);
+
+/**
+ * @brief Create a delta that turns base into next.
+ * 
+ * The delta is an array of operations [op, path, value] as described in
+ * doc/spec.md. Maps are compared by key and arrays by index, everything
+ * else is compared by its encoding. Added map items are appended, so a
+ * map is set as a whole when that would not reproduce the order of its
+ * items in next, or when only one of the maps has an index. Keys are
+ * matched in O(n log n).
+ * 
+ * @param base The previous node.
+ * @param next The current node.
+ * @param delta Receives the new delta node, empty when both are equal.
+ * @return int Error code. 0 is OK, -EINVAL when a compared map has a key
+ *         that is no octet sequence or a key twice, -ELOOP when the nodes
+ *         are nested deeper than TASN1_MAX_DEPTH.
+ */
+int tasn1_diff(const tasn1_node_t *base, const tasn1_node_t *next, tasn1_node_t **delta);
+
+/**
+ * @brief Apply a delta created by tasn1_diff().
+ * 
+ * @param base The node to update. Replaced when the delta sets the root.
+ * @param delta The delta to apply. Always released by this call, values
+ *        are moved into base.
+ * @return int Error code. 0 is OK. On error base may be partially updated.
+ */
+int tasn1_patch(tasn1_node_t **base, tasn1_node_t *delta);
+
+/**
+ * @brief Create nodes from an encoded value. Octet sequences are copied,
+ *        maps with index are decoded as indexed maps. Works for any
+ *        nesting depth.
+ *
+ * @param po Pointer to the encoded value.
+ * @param co Number of octets available.
+ * @param node Receives the decoded node, to be released by tasn1_free().
+ * @return int Number of octets decoded or negative error code. -EINVAL
+ *         for truncated or malformed octets.
+ */
+int tasn1_decode(const TASN1_OCTET *po, size_t co, tasn1_node_t **node);
+
+/**
+ * @brief Apply an encoded delta, e.g. received from a peer that serialized
+ *        the result of tasn1_diff().
+ *
+ * @param base The node to update. Replaced when the delta sets the root.
+ * @param po Pointer to the encoded delta.
+ * @param co Size of the encoded delta.
+ * @return int Error code. 0 is OK, -EINVAL when the octets are not exactly
+ *         one well formed value. On error base may be partially updated.
+ */
+int tasn1_patch_encoded(tasn1_node_t **base, const TASN1_OCTET *po, size_t co);
+
 /**
  * @brief Release all ressources allocated by a node, incl. all related nodes.
+ *        Works without recursion and for any nesting depth.
  * 
  * @param node The node to release.
  */
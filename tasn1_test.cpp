@@ -2,13 +2,21 @@
 #include "tasn1/tasn1.h"
 #include "tasn1/map.hpp"
 #include "tasn1/array.hpp"
+#include "tasn1/ct.hpp"
+#include "tasn1/framer.hpp"
+#include "tasn1/frozen.hpp"
 #include "tasn1/octetsequence.hpp"
 #include "tasn1/number.hpp"
+#include "tasn1/numberarray.hpp"
 
+#undef NDEBUG // The checks below have to run in release builds too
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
 #include <cctype>
+#include <cerrno>
+#include <algorithm>
+#include <thread>
 
 using namespace std;
 using namespace jsonx;
@@ -32,6 +40,23 @@ static void dump(TASN1_OCTET *pb, int cb) {
     printf("\n");
 }
 
+static uint64_t fnv1a(const TASN1_OCTET *po, size_t co) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < co; ++i)
+        hash = (hash ^ po[i]) * 0x100000001b3;
+    return hash;
+}
+
+static uint32_t crc32c(const TASN1_OCTET *po, size_t co) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < co; ++i) {
+        crc ^= po[i];
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+    }
+    return ~crc;
+}
+
 static void c_tests() {
     int erc;
 
@@ -60,6 +85,400 @@ static void c_tests() {
     assert(size2 == size1);
 
     tasn1_free(map1);
+
+    tasn1_node_t *desc = tasn1_new_map();
+    erc = tasn1_add_map_string(desc, "KEY1", false, tasn1_new_string("VAL1", false));
+    assert(erc == 0);
+    int size3 = tasn1_size(desc);
+    TASN1_OCTET buf3[40];
+    erc = tasn1_serialize(desc, buf3, sizeof(buf3));
+    assert(erc == size3);
+
+    tasn1_node_t *frozen1 = tasn1_freeze(desc);
+    assert(frozen1);
+    tasn1_node_t *frozen2 = tasn1_share(frozen1);
+    assert(frozen2);
+    tasn1_node_t *num1 = tasn1_new_number(1);
+    tasn1_node_t *shared1 = tasn1_share(num1);
+    assert(shared1 == NULL);
+    tasn1_free(num1);
+    erc = tasn1_size(frozen2);
+    assert(erc == size3);
+
+    tasn1_node_t *msg1 = tasn1_new_array();
+    erc = tasn1_add_array_value(msg1, frozen1);
+    assert(erc == 0);
+    tasn1_node_t *msg2 = tasn1_new_map();
+    erc = tasn1_add_map_string(msg2, "DESC", false, frozen2);
+    assert(erc == 0);
+
+    TASN1_OCTET buf4[40];
+    int size4 = tasn1_serialize(msg1, buf4, sizeof(buf4));
+    assert(size4 == size3 + 1);
+    assert(memcmp(buf4 + 1, buf3, size3) == 0);
+    tasn1_free(msg1);
+
+    int size5 = tasn1_serialize(msg2, buf4, sizeof(buf4));
+    assert(size5 == size3 + 7);
+    assert(memcmp(buf4 + 7, buf3, size3) == 0);
+    tasn1_free(msg2);
+
+    tasn1_node_t *deep = tasn1_new_array();
+    for (int i = 0; i < 1000; ++i) {
+        tasn1_node_t *outer = tasn1_new_array();
+        erc = tasn1_add_array_value(outer, deep);
+        assert(erc == 0);
+        deep = outer;
+    }
+    size_t stack_size = tasn1_stack_size(1001, 1001);
+    void *stack = malloc(stack_size);
+    int size6 = tasn1_size_ex(deep, stack, stack_size);
+    assert(size6 > 1001);
+    erc = tasn1_size_ex(deep, stack, tasn1_stack_size(TASN1_MAX_DEPTH, 0));
+    assert(erc == -ELOOP);
+    erc = tasn1_size(deep);
+    assert(erc == size6);
+    TASN1_OCTET *buf6 = (TASN1_OCTET *)malloc(size6);
+    erc = tasn1_serialize_ex(deep, buf6, size6, stack, stack_size);
+    assert(erc == size6);
+    assert((buf6[0] >> 5) == (0x04 | TASN1_ARRAY_T));
+    assert(buf6[size6 - 1] == (TASN1_ARRAY_T << 5));
+    erc = tasn1_serialize_ex(deep, buf6, size6, stack, tasn1_stack_size(1000, 1001));
+    assert(erc == -ELOOP);
+    erc = tasn1_serialize_ex(deep, buf6, size6, stack, tasn1_stack_size(1001, 1000));
+    assert(erc == -ELOOP);
+    erc = tasn1_size_ex(deep, stack, tasn1_stack_size(1001, 0));
+    assert(erc == size6);
+    tasn1_node_t *deep_copy = tasn1_clone(deep);
+    assert(deep_copy);
+    TASN1_OCTET *buf6b = (TASN1_OCTET *)malloc(size6);
+    erc = tasn1_serialize(deep_copy, buf6b, size6);
+    assert(erc == size6);
+    assert(memcmp(buf6, buf6b, size6) == 0);
+    erc = tasn1_canonicalize(deep_copy);
+    assert(erc == 0);
+    tasn1_free(deep_copy);
+    erc = tasn1_decode(buf6, size6, &deep_copy);
+    assert(erc == size6);
+    erc = tasn1_serialize(deep_copy, buf6b, size6);
+    assert(erc == size6);
+    assert(memcmp(buf6, buf6b, size6) == 0);
+    tasn1_free(deep_copy);
+    free(buf6b);
+    free(buf6);
+    free(stack);
+    tasn1_free(deep);
+
+    tasn1_node_t *wide = tasn1_new_array();
+    for (int i = 0; i < 2000; ++i) {
+        erc = tasn1_add_array_value(wide, tasn1_new_array());
+        assert(erc == 0);
+    }
+    stack_size = tasn1_stack_size(2, 2001);
+    stack = malloc(stack_size);
+    TASN1_OCTET *buf_wide = (TASN1_OCTET *)malloc(2 * 2003);
+    int size_wide = tasn1_serialize_ex(wide, buf_wide, 2003, stack, stack_size);
+    assert(size_wide == 3 + 2000);
+    erc = tasn1_serialize_ex(wide, buf_wide + 2003, 2003, stack, stack_size - 2);
+    assert(erc == -ELOOP);
+    erc = tasn1_serialize(wide, buf_wide + 2003, 2003);
+    assert(erc == size_wide);
+    assert(memcmp(buf_wide, buf_wide + 2003, size_wide) == 0);
+    free(buf_wide);
+    free(stack);
+    tasn1_free(wide);
+
+    const TASN1_NUMBER samples[] = { 0, 31, 32, 255, 256, -1, -32768, 32767 };
+    const size_t n_samples = sizeof(samples) / sizeof(samples[0]);
+    tasn1_node_t *packed = tasn1_new_number_array(samples, n_samples, false);
+    assert(packed);
+    size_t n_data = 0;
+    const TASN1_NUMBER *data = tasn1_number_array_data(packed, &n_data);
+    assert(data == samples);
+    assert(n_data == n_samples);
+    tasn1_node_t *unpacked = tasn1_new_array();
+    for (size_t i = 0; i < n_samples; ++i) {
+        erc = tasn1_add_array_value(unpacked, tasn1_new_number(samples[i]));
+        assert(erc == 0);
+    }
+    TASN1_OCTET buf7[40], buf8[40];
+    int size7 = tasn1_serialize(packed, buf7, sizeof(buf7));
+    int size8 = tasn1_serialize(unpacked, buf8, sizeof(buf8));
+    assert(size7 == 1 + 1 + 1 + 2 + 2 + 3 + 3 + 3 + 3);
+    assert(size7 == size8);
+    assert(memcmp(buf7, buf8, size7) == 0);
+    assert(buf7[size7 - 8] == 0xff && buf7[size7 - 7] == 0xff);
+    tasn1_free(packed);
+    tasn1_free(unpacked);
+
+    tasn1_node_t *snap1 = tasn1_new_map();
+    tasn1_add_map_string(snap1, "A", false, tasn1_new_number(1));
+    tasn1_add_map_string(snap1, "B", false, tasn1_new_string("x", false));
+    tasn1_node_t *list1 = tasn1_new_array();
+    for (TASN1_NUMBER i = 1; i <= 3; ++i)
+        tasn1_add_array_value(list1, tasn1_new_number(i));
+    tasn1_add_map_string(snap1, "C", false, list1);
+    const char *text = "A longer value that stays the same in both snapshots, "
+                       "so that the delta is much smaller than the next snapshot.";
+    tasn1_add_map_string(snap1, "D", false, tasn1_new_string(text, false));
+    tasn1_add_map_string(snap1, "H", false, tasn1_new_number(300));
+
+    tasn1_node_t *snap2 = tasn1_new_map();
+    tasn1_add_map_string(snap2, "A", false, tasn1_new_number(1));
+    tasn1_add_map_string(snap2, "B", false, tasn1_new_string("y", false));
+    tasn1_node_t *list2 = tasn1_new_array();
+    tasn1_add_array_value(list2, tasn1_new_number(1));
+    tasn1_add_array_value(list2, tasn1_new_number(5));
+    tasn1_add_map_string(snap2, "C", false, list2);
+    tasn1_add_map_string(snap2, "D", false, tasn1_new_string(text, false));
+    tasn1_add_map_string(snap2, "G", false, tasn1_new_number(7));
+
+    tasn1_node_t *delta = NULL;
+    erc = tasn1_diff(snap1, snap2, &delta);
+    assert(erc == 0);
+    int size9 = tasn1_size(delta);
+    int size_snap2 = tasn1_size(snap2);
+    // Set B, set C[1], remove C[2], remove H, set G:
+    assert(size9 == 2 + 9 + 8 + 7 + 6 + 7);
+    assert(size9 < size_snap2 / 3);
+    tasn1_node_t *copy1 = tasn1_clone(snap1);
+    assert(copy1);
+    erc = tasn1_patch(&copy1, delta);
+    assert(erc == 0);
+    TASN1_OCTET buf9[256], buf10[256];
+    int size10 = tasn1_serialize(copy1, buf9, sizeof(buf9));
+    erc = tasn1_serialize(snap2, buf10, sizeof(buf10));
+    assert(erc == size10);
+    assert(memcmp(buf9, buf10, size10) == 0);
+
+    erc = tasn1_diff(snap1, snap2, &delta);
+    assert(erc == 0);
+    TASN1_OCTET delta9[64];
+    int size_delta9 = tasn1_serialize(delta, delta9, sizeof(delta9));
+    assert(size_delta9 == size9);
+    tasn1_free(delta);
+    tasn1_node_t *copy2 = tasn1_clone(snap1);
+    erc = tasn1_patch_encoded(&copy2, delta9, size_delta9 - 1);
+    assert(erc == -EINVAL);
+    tasn1_free(copy2);
+    copy2 = tasn1_clone(snap1);
+    erc = tasn1_patch_encoded(&copy2, delta9, size_delta9);
+    assert(erc == 0);
+    erc = tasn1_serialize(copy2, buf9, sizeof(buf9));
+    assert(erc == size10);
+    assert(memcmp(buf9, buf10, size10) == 0);
+    tasn1_free(copy2);
+
+    tasn1_node_t *decoded = NULL;
+    erc = tasn1_decode(buf10, size10, &decoded);
+    assert(erc == size10);
+    erc = tasn1_serialize(decoded, buf9, sizeof(buf9));
+    assert(erc == size10);
+    assert(memcmp(buf9, buf10, size10) == 0);
+    tasn1_free(decoded);
+
+    erc = tasn1_diff(copy1, snap2, &delta);
+    assert(erc == 0);
+    erc = tasn1_size(delta);
+    assert(erc == 1);
+    tasn1_free(delta);
+
+    erc = tasn1_diff(snap1, list2, &delta);
+    assert(erc == 0);
+    erc = tasn1_patch(&copy1, delta);
+    assert(erc == 0);
+    int size_list2 = tasn1_size(list2);
+    erc = tasn1_size(copy1);
+    assert(erc == size_list2);
+
+    tasn1_node_t *odd1 = tasn1_new_map();
+    tasn1_add_map_item(odd1, tasn1_new_number(1), tasn1_new_number(2));
+    tasn1_node_t *odd2 = tasn1_clone(odd1);
+    tasn1_add_map_string(odd2, "X", false, tasn1_new_number(3));
+    delta = NULL;
+    erc = tasn1_diff(odd1, odd2, &delta);
+    assert(erc == -EINVAL && delta == NULL);
+    tasn1_free(odd1);
+    tasn1_free(odd2);
+
+    tasn1_node_t *dup1 = tasn1_new_map();
+    tasn1_add_map_string(dup1, "k", false, tasn1_new_number(1));
+    tasn1_add_map_string(dup1, "k", false, tasn1_new_number(2));
+    tasn1_node_t *dup2 = tasn1_new_map();
+    tasn1_add_map_string(dup2, "k", false, tasn1_new_number(1));
+    tasn1_add_map_string(dup2, "k", false, tasn1_new_number(3));
+    erc = tasn1_diff(dup1, dup2, &delta);
+    assert(erc == -EINVAL && delta == NULL);
+    tasn1_free(dup1);
+    tasn1_free(dup2);
+
+    // Index added, items reordered, item added in front:
+    tasn1_node_t *order1 = tasn1_new_map();
+    tasn1_add_map_string(order1, "b", false, tasn1_new_number(2));
+    tasn1_add_map_string(order1, "a", false, tasn1_new_number(1));
+    tasn1_node_t *order2[3] = { tasn1_new_indexed_map(), tasn1_new_map(), tasn1_new_map() };
+    tasn1_add_map_string(order2[0], "b", false, tasn1_new_number(2));
+    tasn1_add_map_string(order2[0], "a", false, tasn1_new_number(1));
+    tasn1_add_map_string(order2[1], "a", false, tasn1_new_number(1));
+    tasn1_add_map_string(order2[1], "b", false, tasn1_new_number(2));
+    tasn1_add_map_string(order2[2], "c", false, tasn1_new_number(3));
+    tasn1_add_map_string(order2[2], "b", false, tasn1_new_number(2));
+    tasn1_add_map_string(order2[2], "a", false, tasn1_new_number(1));
+    for (int i = 0; i < 3; ++i) {
+        erc = tasn1_diff(order1, order2[i], &delta);
+        assert(erc == 0);
+        erc = tasn1_serialize(delta, buf9, sizeof(buf9));
+        assert(erc > 4);
+        // A single set of the root, i.e. with an empty path:
+        assert(buf9[0] == (TASN1_ARRAY_T << 5 | (erc - 1)));
+        const TASN1_OCTET *op = buf9 + 2;
+        assert(op[0] == (TASN1_NUMBER_T << 5 | TASN1_DELTA_SET) && op[1] == (TASN1_ARRAY_T << 5));
+        tasn1_node_t *patched = tasn1_clone(order1);
+        erc = tasn1_patch(&patched, delta);
+        assert(erc == 0);
+        int size_patched = tasn1_serialize(patched, buf9, sizeof(buf9));
+        erc = tasn1_serialize(order2[i], buf10, sizeof(buf10));
+        assert(erc == size_patched);
+        assert(memcmp(buf9, buf10, size_patched) == 0);
+        tasn1_free(patched);
+        tasn1_free(order2[i]);
+    }
+    tasn1_free(order1);
+
+    tasn1_free(copy1);
+    tasn1_free(snap1);
+    tasn1_free(snap2);
+
+    const char *keys[] = { "c", "a", "bb", "b", "aa" };
+    tasn1_node_t *config = tasn1_new_indexed_map();
+    for (TASN1_NUMBER i = 0; i < 5; ++i) {
+        erc = tasn1_add_map_string(config, keys[i], false, tasn1_new_number(i));
+        assert(erc == 0);
+    }
+    tasn1_node_t *num2 = tasn1_new_number(1);
+    erc = tasn1_add_map_item(config, num2, num2);
+    assert(erc == -EINVAL);
+    tasn1_free(num2);
+    tasn1_node_t *empty = tasn1_new_octet_sequence(NULL, 0, true);
+    tasn1_node_t *num3 = tasn1_new_number(3);
+    tasn1_node_t *plain = tasn1_new_map();
+    erc = tasn1_add_map_item(config, empty, num3);
+    assert(erc == -EINVAL);
+    erc = tasn1_add_map_item(plain, empty, num3);
+    assert(erc == -EINVAL);
+    tasn1_free(plain);
+    tasn1_free(empty);
+    tasn1_free(num3);
+    TASN1_OCTET buf11[64];
+    int size11 = tasn1_serialize(config, buf11, sizeof(buf11));
+    assert(size11 == 2 + (1 + 1 + 2 * 5) + (3 * 3 + 2 * 4) + 5);
+    assert(buf11[2] == (TASN1_OCTET_SEQUENCE_T << 5));
+    assert(buf11[14] == (TASN1_OCTET_SEQUENCE_T << 5 | 2) && buf11[15] == 'a');
+    for (TASN1_NUMBER i = 0; i < 5; ++i) {
+        const TASN1_OCTET *val = NULL;
+        erc = tasn1_map_lookup_string(buf11, size11, keys[i], &val);
+        assert(erc == 1);
+        assert(*val == (TASN1_NUMBER_T << 5 | i));
+    }
+    const TASN1_OCTET *val = NULL;
+    erc = tasn1_map_lookup_string(buf11, size11, "ab", &val);
+    assert(erc == -ENOENT);
+    erc = tasn1_map_lookup_string(buf11, size11, "", &val);
+    assert(erc == -ENOENT);
+    tasn1_free(config);
+    erc = tasn1_decode(buf11, size11, &config);
+    assert(erc == size11);
+    erc = tasn1_add_map_string(config, "ab", false, tasn1_new_number(5));
+    assert(erc == 0);
+    size11 = tasn1_serialize(config, buf11, sizeof(buf11));
+    erc = tasn1_map_lookup_string(buf11, size11, "ab", &val);
+    assert(erc == 1);
+    assert(*val == (TASN1_NUMBER_T << 5 | 5));
+    tasn1_free(config);
+
+    erc = tasn1_map_lookup_string(buf2, size2, "KEY2", &val);
+    assert(erc == 1);
+    assert(*val == (TASN1_NUMBER_T << 5 | 1));
+    erc = tasn1_map_lookup_string(buf2, size2, "KEY3", &val);
+    assert(erc == -ENOENT);
+
+    char key12[] = "K1";
+    tasn1_node_t *map12 = tasn1_new_map();
+    erc = tasn1_add_map_string(map12, key12, true, tasn1_new_number(-1));
+    assert(erc == 0);
+    erc = tasn1_add_map_string(map12, "LONG KEY 12", true, tasn1_new_number(300));
+    assert(erc == 0);
+    key12[1] = '2';
+    TASN1_OCTET buf12[32];
+    int size12 = tasn1_serialize(map12, buf12, sizeof(buf12));
+    assert(size12 == 1 + (1 + 3) + 3 + (1 + 12) + 3);
+    assert(memcmp(buf12 + 2, "K1", 3) == 0);
+    assert(buf12[6] == 0xff && buf12[7] == 0xff);
+    tasn1_free(map12);
+    erc = tasn1_decode(buf12, size12 + 1, &map12);
+    assert(erc == size12);
+    TASN1_OCTET buf12b[32];
+    erc = tasn1_serialize(map12, buf12b, sizeof(buf12b));
+    assert(erc == size12);
+    assert(memcmp(buf12, buf12b, size12) == 0);
+    tasn1_free(map12);
+    buf12[1] = TASN1_NUMBER_T << 5 | 1;
+    erc = tasn1_decode(buf12, size12, &map12);
+    assert(erc == -EINVAL);
+
+    tasn1_node_t *doc13[2];
+    for (int i = 0; i < 2; ++i) {
+        const char *order[] = { "b", "a", "c" };
+        doc13[i] = tasn1_new_map();
+        for (int j = 0; j < 3; ++j) {
+            const char *key = order[i ? 2 - j : j];
+            erc = tasn1_add_map_string(doc13[i], key, false, tasn1_new_number(key[0]));
+            assert(erc == 0);
+        }
+        tasn1_node_t *inner = tasn1_new_indexed_map();
+        erc = tasn1_add_map_string(inner, "x", false, tasn1_new_number(1));
+        assert(erc == 0);
+        tasn1_node_t *outer = tasn1_new_array();
+        erc = tasn1_add_array_value(outer, inner);
+        assert(erc == 0);
+        erc = tasn1_add_map_string(doc13[i], "a", false, outer);
+        assert(erc == 0);
+        erc = tasn1_canonicalize(doc13[i]);
+        assert(erc == 0);
+    }
+    TASN1_OCTET buf13[2][64];
+    uint64_t hash13[2];
+    int size13 = tasn1_serialize_hash(doc13[0], buf13[0], sizeof(buf13[0]), &hash13[0]);
+    assert(size13 == 1 + (3 + 2) + (3 + 10) + (3 + 2) + (3 + 2));
+    erc = tasn1_serialize_hash(doc13[1], buf13[1], sizeof(buf13[1]), &hash13[1]);
+    assert(erc == size13);
+    assert(memcmp(buf13[0], buf13[1], size13) == 0);
+    assert(buf13[0][2] == 'a' && buf13[0][7] == 'a' && buf13[0][20] == 'b');
+    assert(hash13[0] == hash13[1]);
+    assert(hash13[0] == fnv1a(buf13[0], size13));
+    tasn1_free(doc13[1]);
+    tasn1_node_t *frozen13 = tasn1_freeze(doc13[0]);
+    uint64_t hash14 = 0;
+    erc = tasn1_hash(frozen13, &hash14);
+    assert(erc == 0 && hash14 == hash13[0]);
+
+    TASN1_OCTET buf15[64];
+    erc = tasn1_serialize_framed(frozen13, buf15, size13 + 3);
+    assert(erc == -ENOMEM);
+    int size15 = tasn1_serialize_framed(frozen13, buf15, sizeof(buf15));
+    assert(size15 == size13 + TASN1_CRC_SIZE);
+    assert(memcmp(buf15, buf13[0], size13) == 0);
+    uint32_t crc15 = crc32c(buf15, size13);
+    assert(buf15[size13] == (crc15 >> 24) && buf15[size13 + 3] == (crc15 & 0xff));
+    val = NULL;
+    erc = tasn1_verify_framed(buf15, size15, &val);
+    assert(erc == size13 && val == buf15);
+    erc = tasn1_verify_framed(buf15, size15 - 1, &val);
+    assert(erc == 0);
+    buf15[5] ^= 0x01;
+    erc = tasn1_verify_framed(buf15, size15, &val);
+    assert(erc == -EBADMSG);
+    tasn1_free(frozen13);
 }
 
 static void cpp_tests() {
@@ -97,6 +516,226 @@ static void cpp_tests() {
     n1.serialize(buffer);
 
     dump(buffer.data(), buffer.size());
+
+    tasn1::Map desc;
+    tasn1::Number val3(static_cast<int16_t>(7));
+    desc.add("KEY1", val3);
+    tasn1::Frozen frozen1(desc);
+    assert(desc.isContained() && desc.getNode() == nullptr);
+    bool released{false};
+    try {
+        desc.serialize(buffer);
+    } catch (const std::runtime_error &) {
+        released = true;
+    }
+    assert(released);
+    tasn1::Frozen frozen2{frozen1.share()};
+    tasn1::Array msg1;
+    msg1.add(frozen1);
+    msg1.add(frozen2);
+    msg1.serialize(buffer);
+    assert(buffer.size() == 1 + 2 * 8);
+    assert(memcmp(buffer.data() + 1, buffer.data() + 9, 8) == 0);
+
+    std::vector<int16_t> wave(1000);
+    for (size_t i = 0; i < wave.size(); ++i)
+        wave[i] = static_cast<int16_t>(i % 32);
+    tasn1::NumberArray packed(wave);
+    assert(packed.size() == wave.size());
+    assert(packed.data()[999] == 7);
+    packed.serialize(buffer);
+    assert(buffer.size() == 3 + wave.size());
+    assert(buffer[3 + 999] == ((TASN1_NUMBER_T << 5) | 7));
+
+    tasn1::vector_t stream;
+    std::vector<size_t> sizes;
+    for (Node *n : std::vector<Node *>{ &map1, &packed, &val2, &n1 }) {
+        n->serialize(buffer);
+        stream.insert(stream.end(), buffer.begin(), buffer.end());
+        sizes.push_back(buffer.size());
+    }
+    for (size_t chunk : { stream.size(), size_t(1), size_t(2), size_t(5), size_t(700) }) {
+        tasn1::Framer framer;
+        tasn1::vector_t received;
+        std::vector<size_t> received_sizes;
+        for (size_t i = 0; i < stream.size(); i += chunk) {
+            tasn1::batch_t batch;
+            size_t n = std::min(chunk, stream.size() - i);
+            size_t count = framer.feed(stream.data() + i, n, batch);
+            assert(count == batch.size());
+            for (const tasn1::Frame &frame : batch) {
+                received.insert(received.end(), frame.data, frame.data + frame.size);
+                received_sizes.push_back(frame.size);
+            }
+        }
+        assert(framer.pending() == 0);
+        assert(received == stream);
+        assert(received_sizes == sizes);
+    }
+
+    json x10 = jarray({
+        false,
+        2,
+        jobject({
+            jitem("First",99),
+            jitem("Second","Blab"),
+            jitem("Zeta", 4)
+        })
+    });
+    Node n2 = Node::fromJson(x10);
+    Node delta = Node::diff(n1, n2);
+    Node n3 = n1.clone();
+    n3.patch(delta);
+    assert(delta.isContained());
+    tasn1::vector_t buffer2;
+    n2.serialize(buffer);
+    n3.serialize(buffer2);
+    assert(buffer == buffer2);
+    tasn1::vector_t encodedDelta;
+    Node::diff(n1, n2).serialize(encodedDelta);
+    Node n4 = n1.clone();
+    n4.patch(encodedDelta);
+    n4.serialize(buffer2);
+    assert(buffer == buffer2);
+    Node n5 = Node::decode(buffer);
+    n5.serialize(buffer2);
+    assert(buffer == buffer2);
+
+    tasn1::Map indexed(true);
+    tasn1::Number val4(static_cast<int16_t>(4));
+    tasn1::Number val5(static_cast<int16_t>(5));
+    indexed.add("KEY5", val5);
+    indexed.add("KEY4", val4);
+    tasn1::Number badKey(static_cast<int16_t>(6));
+    tasn1::Number val6b(static_cast<int16_t>(6));
+    bool rejected{false};
+    try {
+        indexed.add(badKey, val6b);
+    } catch (const std::runtime_error &) {
+        rejected = true;
+    }
+    assert(rejected && !badKey.isContained() && !val6b.isContained());
+    indexed.serialize(buffer);
+    const uint8_t *pv{nullptr};
+    int found{tasn1_map_lookup_string(buffer.data(), buffer.size(), "KEY4", &pv)};
+    assert(found == 1);
+    assert(*pv == (TASN1_NUMBER_T << 5 | 4));
+
+    tasn1::Map canonical;
+    tasn1::Number val6(static_cast<int16_t>(4));
+    tasn1::Number val7(static_cast<int16_t>(5));
+    canonical.add("KEY4", val6);
+    canonical.add("KEY5", val7);
+    assert(canonical.hash() != indexed.hash());
+    tasn1::Map reordered;
+    tasn1::Number val8(static_cast<int16_t>(5));
+    tasn1::Number val9(static_cast<int16_t>(4));
+    reordered.add("KEY5", val8);
+    reordered.add("KEY4", val9);
+    assert(canonical.hash() != reordered.hash());
+    reordered.canonicalize();
+    uint64_t hash{0};
+    reordered.serialize(buffer, hash);
+    canonical.serialize(buffer2);
+    assert(buffer == buffer2);
+    assert(hash == canonical.hash());
+
+    tasn1::vector_t framed_stream;
+    tasn1::vector_t plain_stream;
+    tasn1::vector_t surviving_stream;
+    size_t corrupt_at{0};
+    for (Node *n : std::vector<Node *>{ &canonical, &n2, &indexed }) {
+        if (n == &n2)
+            corrupt_at = framed_stream.size() + 2;
+        n->serializeFramed(buffer);
+        framed_stream.insert(framed_stream.end(), buffer.begin(), buffer.end());
+        n->serialize(buffer);
+        plain_stream.insert(plain_stream.end(), buffer.begin(), buffer.end());
+        if (n != &n2)
+            surviving_stream.insert(surviving_stream.end(), buffer.begin(), buffer.end());
+    }
+    for (size_t chunk : { framed_stream.size(), size_t(1), size_t(3) }) {
+        tasn1::Framer framer(true);
+        tasn1::vector_t received;
+        for (size_t i = 0; i < framed_stream.size(); i += chunk) {
+            tasn1::batch_t batch;
+            size_t n = std::min(chunk, framed_stream.size() - i);
+            framer.feed(framed_stream.data() + i, n, batch);
+            for (const tasn1::Frame &frame : batch)
+                received.insert(received.end(), frame.data, frame.data + frame.size);
+        }
+        assert(framer.pending() == 0);
+        assert(framer.corrupted() == 0);
+        assert(received == plain_stream);
+    }
+    framed_stream[corrupt_at] ^= 0x01;
+    for (size_t chunk : { framed_stream.size(), size_t(1), size_t(3), size_t(50) }) {
+        tasn1::Framer framer(true);
+        tasn1::vector_t received;
+        for (size_t i = 0; i < framed_stream.size(); i += chunk) {
+            tasn1::batch_t batch;
+            size_t n = std::min(chunk, framed_stream.size() - i);
+            size_t count = framer.feed(framed_stream.data() + i, n, batch);
+            assert(count == batch.size());
+            for (const tasn1::Frame &frame : batch)
+                received.insert(received.end(), frame.data, frame.data + frame.size);
+        }
+        assert(framer.pending() == 0);
+        assert(framer.corrupted() == 1);
+        assert(received == surviving_stream);
+    }
+
+    json_array_t records;
+    json_object_t totals;
+    for (int i = 0; i < 200; ++i) {
+        records.push_back(jobject({ jitem("id", i * 300), jitem("name", "n" + std::to_string(i)) }));
+        if (i < 100)
+            totals.insert(jitem("k" + std::to_string(i), i * 7));
+    }
+    json x11 = jobject({
+        jitem("records", json::mkarray(records)),
+        jitem("totals", json::mkobject(totals)),
+        jitem("more", jarray({ json::mkarray(records), 5 }))
+    });
+    Node::fromJson(x11).serialize(buffer);
+    for (unsigned threads : { 0u, 1u, 3u, 8u, 1000u }) {
+        Node::fromJson(x11, threads).serialize(buffer2);
+        assert(buffer == buffer2);
+    }
+
+    Node shared{Node::fromJson(x11)};
+    std::vector<tasn1::vector_t> outputs(4);
+    std::vector<std::thread> writers;
+    for (tasn1::vector_t &output : outputs)
+        writers.emplace_back([&shared, &output] { shared.serialize(output); });
+    for (std::thread &writer : writers)
+        writer.join();
+    for (const tasn1::vector_t &output : outputs)
+        assert(output == buffer);
+
+    constexpr auto hello{tasn1::ct::map(
+        tasn1::ct::item("KEY1", "VAL1"),
+        tasn1::ct::item("KEY2", tasn1::ct::boolean<true>()),
+        tasn1::ct::item("N", tasn1::ct::array(tasn1::ct::number<-1>(), tasn1::ct::number<31>(),
+                                              tasn1::ct::number<32>(), tasn1::ct::number<256>())),
+        tasn1::ct::item("LONG", "A value that needs a long header"))};
+    static_assert(hello[0] == (0x80 | TASN1_MAP_T << 5 | 0x01), "Long map header");
+    tasn1::Map hello_map;
+    tasn1::OctetSequence hello_val1("VAL1");
+    tasn1::Number hello_val2(true);
+    tasn1::Array hello_list;
+    for (int16_t n : { -1, 31, 32, 256 }) {
+        tasn1::Number item(n);
+        hello_list.add(item);
+    }
+    tasn1::OctetSequence hello_val4("A value that needs a long header");
+    hello_map.add("KEY1", hello_val1);
+    hello_map.add("KEY2", hello_val2);
+    hello_map.add("N", hello_list);
+    hello_map.add("LONG", hello_val4);
+    hello_map.serialize(buffer);
+    assert(buffer.size() == hello.size());
+    assert(std::equal(buffer.begin(), buffer.end(), hello.begin()));
 }
 
 int main() {